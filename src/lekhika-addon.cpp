@@ -1,9 +1,14 @@
 // lekhika_addon.cpp
 
 #include "lekhika-addon.h"
+#include "lekhika-normalize.h"
+#include "lekhika-romanize.h"
+#include "lekhika-scan.h"
+#include "lekhika-utf8.h"
 
 #include <fcitx-config/iniparser.h>
 #include <fcitx-utils/fs.h>
+#include <fcitx-utils/log.h>
 #include <fcitx-utils/standardpath.h>
 #include <fcitx-utils/utf8.h>
 #include <fcitx/addonfactory.h>
@@ -18,15 +23,209 @@
 #endif
 
 #include <sys/stat.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <vector>
 
 using namespace fcitx;
 
+namespace {
+
+constexpr char kLekhikaDataDir[] = "lekhika-core";
+// The Nepali input method; every other entry is a language variant
+constexpr char kBaseInputMethod[] = "fcitx5lekhika";
+constexpr char kVariantRewriteDir[] = "lekhika/variants/";
+// Keyboard layout input methods are named after their layout file
+constexpr char kLayoutInputMethodPrefix[] = "fcitx5lekhika-layout-";
+constexpr char kLayoutDir[] = "lekhika/layouts/";
+constexpr char kSystemWordList[] = "wordlist.txt";
+constexpr char kDomainListDir[] = "domains";
+constexpr char kSourceSystem[] = "system";
+constexpr char kSourceUser[] = "user";
+constexpr char kSnippetFile[] = "snippets.txt";
+constexpr char kSymbolTable[] = "lekhika/symbols.txt";
+constexpr char kEnglishWordList[] = "lekhika/english-words.txt";
+// Shorter words collide too often with Roman Nepali ("ma", "ho", "ke")
+constexpr size_t kMinEnglishLength = 3;
+// From this length on, a common English word skips the Nepali dictionary
+constexpr size_t kEnglishOnlyLength = 4;
+// Letters at the end of a long buffer that are never committed early; no
+// mapping reaches back further when the next key is typed
+constexpr size_t kUnstableTail = 4;
+// Splits tried per key when looking for a stable prefix; past twice the
+// composing limit the head is committed even if no split was stable
+constexpr size_t kMaxStableSplits = 8;
+// A list cut short by the key's budget is finished in steps this far apart,
+// each with twice the budget of the one before
+constexpr uint64_t kRefineStepDelayUs = 1000;
+constexpr int kMaxRefineDoublings = 12;
+// Word lists still waiting for their first lookup are loaded one per step
+// this long apart, starting after activation, so no key pays for it
+constexpr uint64_t kPreloadStepDelayUs = 100000;
+constexpr char kRecentFile[] = "recent.snapshot";
+constexpr uint64_t kRecentSaveDelayUs = 10000000;
+// Recent words scoring this much are trusted to fill the list on their
+// own: two uses within the last couple of hundred commits, or more uses
+// longer ago. The score halves every few hundred commits, so a word
+// nobody types any more drops back among the dictionary words.
+constexpr double kConfidentRecentScore = 1.5;
+// Keeps trusted recent words above every dictionary score
+constexpr double kRecentTierScore = 1000.0;
+// Shorter triggers are only offered when they are the whole buffer
+constexpr size_t kMinSnippetSuffix = 3;
+
+#ifdef HAVE_SQLITE3
+constexpr char kDictionaryFile[] = "lekhikadict.akshardb";
+constexpr char kSnapshotFile[] = "suggestions.snapshot";
+// The addon's own tables, kept out of liblekhika's database
+constexpr char kStoreFile[] = "fcitx5-lekhika.db";
+// Only the most frequent learned words go into the snapshot; rarer ones
+// are suggested only while a rebuild is pending and lookups go to the
+// database
+constexpr int kSnapshotMaxWords = 200000;
+constexpr uint64_t kSnapshotCheckIntervalUs = 1000000;
+constexpr uint64_t kSnapshotPublishDelayUs = 5000000;
+constexpr uint64_t kSnapshotStartupDelayUs = 3000000;
+constexpr int kMaxSelectionsPerPrefix = 16;
+#endif
+
+// Files shared with liblekhika and lekhika-trainer live in its data dir
+std::string lekhikaDataPath(const std::string &name) {
+    auto path = StandardPath::global().userDirectory(StandardPath::Type::Data) +
+                "/" + kLekhikaDataDir + "/" + name;
+    fs::makePath(path.substr(0, path.rfind('/')));
+    return path;
+}
+
 #ifdef HAVE_SQLITE3
+// Changes whenever any program writes the word database. In WAL mode the
+// writes land in the -wal file until a checkpoint. The addon's own tables
+// live elsewhere, so picking a candidate leaves it alone.
+uint64_t dictionaryStamp() {
+    auto path = lekhikaDataPath(kDictionaryFile);
+    return fileStamp(path) * 31 + fileStamp(path + "-wal");
+}
+
+std::vector<SnapshotEntry> snapshotEntries(std::vector<WordStore::Word> words) {
+    std::vector<SnapshotEntry> entries;
+    entries.reserve(words.size());
+    for (auto &word : words) {
+        if (lekhika::validateUtf8(word.text)) {
+            auto weight = std::min<int64_t>(
+                std::max<int64_t>(word.frequency, 0), UINT32_MAX);
+            entries.push_back({lekhika::toNfc(std::move(word.text)), {},
+                               static_cast<uint32_t>(weight)});
+        }
+    }
+    return entries;
+}
+#endif
+
+bool isSymbolQuery(const std::string &buffer) {
+    return !buffer.empty() && buffer[0] == ':';
+}
+
+double percent(int value) { return std::max(0, value) / 100.0; }
+
+bool isLayoutInputMethod(const std::string &uniqueName) {
+    return uniqueName.compare(0, sizeof(kLayoutInputMethodPrefix) - 1,
+                              kLayoutInputMethodPrefix) == 0;
+}
+
+// Whether text typed with a layout continues a word; digits, dandas and
+// the like end it
+bool isWordText(const std::string &text) {
+    if (!lekhika::isDevanagari(text)) {
+        return false;
+    }
+    const auto *p = reinterpret_cast<const unsigned char *>(text.data());
+    if (p[0] != 0xE0) {
+        return true; // a joiner
+    }
+    uint32_t cp = 0x0900 + ((p[1] & 0x01u) << 6) + (p[2] & 0x3Fu);
+    return cp != 0x0950 && (cp < 0x0964 || cp > 0x0970);
+}
+
+std::string inputMethodConfigPath(const std::string &uniqueName) {
+    return StandardPath::global().userDirectory(StandardPath::Type::PkgConfig) +
+           "/conf/" + uniqueName + ".conf";
+}
+
+// A word still being typed often ends in a halant ("nam" -> नम्) that the
+// next vowel or conjunct replaces. The consonant without it covers every
+// way the word can go on: नम finds नमस्ते and नम्र alike.
+std::string dictionaryQuery(const std::string &preview) {
+    static const char *const kUnstableTails[] = {
+        "\xE0\xA5\x8D\xE2\x80\x8D", // halant + ZWJ
+        "\xE0\xA5\x8D\xE2\x80\x8C", // halant + ZWNJ
+        "\xE0\xA5\x8D",             // halant
+    };
+    for (const char *tail : kUnstableTails) {
+        size_t length = std::strlen(tail);
+        if (preview.size() > length &&
+            preview.compare(preview.size() - length, length, tail) == 0) {
+            return preview.substr(0, preview.size() - length);
+        }
+    }
+    return preview;
+}
+
+// Finished words of the sentence being composed, as they will be committed
+std::string sentenceText(const NepaliRomanState *state) {
+    std::string text;
+    for (const auto &word : state->sentence_) {
+        text += word.output;
+    }
+    return text;
+}
+
+// The candidates on screen, so a composition can be shown again as it was
+void captureCandidates(InputContext *ic, CommitRecord &record) {
+    if (auto candidateList = ic->inputPanel().candidateList()) {
+        for (int i = 0; i < candidateList->size(); ++i) {
+            record.candidates.push_back(
+                candidateList->candidate(i).text().toString());
+        }
+        record.candidateCursor = candidateList->cursorIndex();
+    }
+}
+
+std::vector<std::string> listFiles(const std::string &dir,
+                                   const std::string &suffix) {
+    std::vector<std::string> files;
+    DIR *handle = ::opendir(dir.c_str());
+    if (!handle) {
+        return files;
+    }
+    while (auto *entry = ::readdir(handle)) {
+        std::string name = entry->d_name;
+        if (name.size() > suffix.size() &&
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            files.push_back(std::move(name));
+        }
+    }
+    ::closedir(handle);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+} // namespace
+
+  //=============================================================================//
+ // LekhikaCandidateWord Implementation                                         //
+//=============================================================================//
+
+void LekhikaCandidateWord::select(InputContext *ic) const {
+    engine_->selectCandidate(ic, this);
+}
+
   //=============================================================================//
  // LekhikaCandidateList Implementation                                         //
 //=============================================================================//
@@ -48,7 +247,6 @@ void LekhikaCandidateList::append(std::unique_ptr<CandidateWord> word) {
     words_.emplace_back(std::move(word));
     labels_.emplace_back(std::to_string(words_.size()));
 }
-#endif
 
   //=============================================================================//
  // NepaliRomanEngine Implementation                                            //
@@ -59,14 +257,63 @@ NepaliRomanEngine::NepaliRomanEngine(Instance *instance)
     factory_([](InputContext &) { return new NepaliRomanState; }) {
     instance_->inputContextManager().registerProperty("nepaliRomanState",
                                                       &factory_);
+    // Cheap enough to load before anything else, so the first keystrokes
+    // already have suggestions
+    recent_.load(lekhikaDataPath(kRecentFile));
 #ifdef HAVE_SQLITE3
     dictionary_ = std::make_unique<DictionaryManager>();
+    store_ = std::make_unique<WordStore>();
+    if (!store_->open(lekhikaDataPath(kDictionaryFile),
+                      lekhikaDataPath(kStoreFile))) {
+        store_.reset();
+    }
 #endif
     transliterator_ = std::make_unique<Transliteration>();
     ensureConfigExists();
+#ifdef HAVE_SQLITE3
+    publishDispatcher_.attach(&instance_->eventLoop());
+    // Missing, or built before the database last changed: rebuild it, and
+    // answer from the database until then
+    if (!snapshot_.open(lekhikaDataPath(kSnapshotFile)) ||
+        snapshot_.source() != dictionaryStamp()) {
+        snapshotDirty_ = true;
+        reindexLearned_ = true;
+        scheduleSnapshotPublish(kSnapshotStartupDelayUs);
+    } else if (store_ && !store_->indexed()) {
+        reindexLearned_ = true;
+        scheduleSnapshotPublish(kSnapshotStartupDelayUs);
+    }
+    boosts_.setLoader([this](const std::string &prefix) {
+        SelectionBoosts::Counts counts;
+        if (store_) {
+            for (auto &word :
+                 store_->findSelections(prefix, kMaxSelectionsPerPrefix)) {
+                counts.emplace_back(std::move(word.text), word.frequency);
+            }
+        }
+        return counts;
+    });
+#endif
+    setupSuggestionSources();
+    symbols_ = std::make_unique<SymbolIndex>(
+        StandardPath::global().locate(StandardPath::Type::PkgData, kSymbolTable),
+        lekhikaDataPath("cache/symbols.snapshot"));
+    english_.load(StandardPath::global().locate(StandardPath::Type::PkgData,
+                                                kEnglishWordList));
+    loadSnippets();
     applyConfig();
 }
 
+NepaliRomanEngine::~NepaliRomanEngine() {
+#ifdef HAVE_SQLITE3
+    // A snapshot being written is finished rather than left half done
+    if (publishThread_.joinable()) {
+        publishThread_.join();
+    }
+    publishDispatcher_.detach();
+#endif
+}
+
 const Configuration *NepaliRomanEngine::getConfig() const { return &config_; }
 
 Configuration *NepaliRomanEngine::getMutableConfig() { return &config_; }
@@ -87,19 +334,51 @@ void NepaliRomanEngine::applyConfig() {
     enableIndicNumbers_ = config_.enableIndicNumbers.value();
     enableSymbolsTransliteration_ = config_.enableSymbolsTransliteration.value();
     spacecanCommitSuggestions_ = config_.spacecanCommitSuggestions.value();
+    sentenceMode_ = config_.sentenceMode.value();
+    convertSelectionKey_ = config_.convertSelectionKey.value();
+    romanizeSelectionKey_ = config_.romanizeSelectionKey.value();
+    undoCommitKey_ = config_.undoCommitKey.value();
+    speculativePrefetchKeys_ =
+        std::max(0, config_.speculativePrefetchKeys.value());
 
 #ifdef HAVE_SQLITE3
     enableDictionaryLearning_ = config_.enableDictionaryLearning.value();
+#endif
     enableSuggestion_ = config_.enableSuggestion.value();
     suggestionLimit_ = config_.suggestionLimit.value();
+    suggestionDeadlineMs_ = std::max(0, config_.suggestionDeadlineMs.value());
+    keyLatencyBudgetMs_ = std::max(0, config_.keyLatencyBudgetMs.value());
+    maxComposingLength_ = std::max(0, config_.maxComposingLength.value());
     horizontalLayout_ = config_.horizontalLayout.value();
-#endif
+    enableSnippets_ = config_.enableSnippets.value();
+    expandSnippetsOnCommit_ = config_.expandSnippetsOnCommit.value();
+    enableSymbolPicker_ = config_.enableSymbolPicker.value();
+    detectEnglishWords_ = config_.detectEnglishWords.value();
+    offerSpellingVariants_ = config_.offerSpellingVariants.value();
+    showInlineCompletion_ = config_.showInlineCompletion.value();
+    layoutSuggestions_ = config_.layoutSuggestions.value();
+    // A language variant brings its own corrections and suggestions
+    if (variant_) {
+        const auto &variantConfig = variant_->config;
+        enableSmartCorrection_ = variantConfig.enableSmartCorrection.value();
+        enableAutoCorrect_ = variantConfig.enableAutoCorrect.value();
+        enableIndicNumbers_ = variantConfig.enableIndicNumbers.value();
+        enableSuggestion_ =
+            enableSuggestion_ && variantConfig.enableSuggestion.value();
+    }
+    applySourceWeights();
 
     transliterator_->setEnableSmartCorrection(enableSmartCorrection_);
     transliterator_->setEnableAutoCorrect(enableAutoCorrect_);
     transliterator_->setEnableIndicNumbers(enableIndicNumbers_);
     transliterator_->setEnableSymbolsTransliteration(
         enableSymbolsTransliteration_);
+
+    // Anything computed ahead of time used the old settings
+    prefetchEvent_.reset();
+    speculative_.clear();
+    queries_.clear();
+    completions_.clear();
 }
 
 void NepaliRomanEngine::ensureConfigExists() {
@@ -123,38 +402,164 @@ void NepaliRomanEngine::reloadConfig() {
     }
     config_.load(rawConfig);
     applyConfig();
+    loadSnippets();
 }
 
-void NepaliRomanEngine::activate(const InputMethodEntry &, InputContextEvent &) {
+void NepaliRomanEngine::activate(const InputMethodEntry &entry,
+                                 InputContextEvent &) {
     reloadConfig();
+    selectVariant(entry);
+    schedulePreload();
+}
+
+const Configuration *
+NepaliRomanEngine::getConfigForInputMethod(const InputMethodEntry &entry) const {
+    auto *variant = variantFor(entry);
+    return variant ? &variant->config : getConfig();
+}
+
+void NepaliRomanEngine::setConfigForInputMethod(const InputMethodEntry &entry,
+                                                const RawConfig &config) {
+    auto *variant = variantFor(entry);
+    if (!variant) {
+        setConfig(config);
+        return;
+    }
+    variant->config.load(config);
+    auto filePath = inputMethodConfigPath(variant->uniqueName);
+    fs::makePath(filePath.substr(0, filePath.rfind('/')));
+    safeSaveAsIni(variant->config, filePath);
+    if (variant == variant_) {
+        applyConfig();
+    }
+}
+
+LanguageVariant *
+NepaliRomanEngine::variantFor(const InputMethodEntry &entry) const {
+    if (entry.uniqueName() == kBaseInputMethod ||
+        isLayoutInputMethod(entry.uniqueName())) {
+        return nullptr;
+    }
+    auto &variant = variants_[entry.uniqueName()];
+    if (!variant) {
+        variant = std::make_unique<LanguageVariant>();
+        variant->uniqueName = entry.uniqueName();
+        variant->code = entry.languageCode();
+        RawConfig rawConfig;
+        auto filePath = inputMethodConfigPath(variant->uniqueName);
+        if (fs::isreg(filePath)) {
+            readAsIni(rawConfig, filePath);
+        }
+        variant->config.load(rawConfig);
+    }
+    return variant.get();
+}
+
+// Switches tables, word lists and settings to the language of entry. A
+// language's tables and lists are loaded when it is first used and kept,
+// so switching back and forth costs nothing.
+void NepaliRomanEngine::selectVariant(const InputMethodEntry &entry) {
+    LanguageVariant *variant = variantFor(entry);
+    if (variant == variant_) {
+        return;
+    }
+    variant_ = variant;
+    if (variant_ && !variant_->rewritesLoaded) {
+        // Shipped rules first, so the user's file can replace them
+        std::string name = variant_->code + ".txt";
+        auto systemRules = StandardPath::global().locate(
+            StandardPath::Type::PkgData, kVariantRewriteDir + name);
+        if (!systemRules.empty()) {
+            variant_->rewrites.load(systemRules);
+        }
+        auto userRules = lekhikaDataPath("variants/" + name);
+        if (fs::isreg(userRules)) {
+            variant_->rewrites.load(userRules);
+        }
+        variant_->rewritesLoaded = true;
+    }
+    // Each language indexes its lists once and keeps them
+    sources_ = variant_ ? &variant_->sources : &nepaliSources_;
+    if (variant_ && !variant_->sourcesReady) {
+        setupSuggestionSources();
+        variant_->sourcesReady = true;
+    }
+    applyConfig();
 }
 
-void NepaliRomanEngine::keyEvent(const InputMethodEntry &, KeyEvent &keyEvent) {
+void NepaliRomanEngine::keyEvent(const InputMethodEntry &entry,
+                                 KeyEvent &keyEvent) {
     auto *ic = keyEvent.inputContext();
     if (!ic || keyEvent.isRelease()) {
         return;
     }
+    // Another context may be typing in another language
+    selectVariant(entry);
 
     auto *state = ic->propertyFor(&factory_);
+    uint64_t start = now(CLOCK_MONOTONIC);
+    if (const auto *layout = layoutFor(entry)) {
+        handleLayoutKey(*layout, state, keyEvent);
+    } else {
+        handleKey(state, keyEvent);
+    }
+    watchLatency(state, ic, now(CLOCK_MONOTONIC) - start);
+}
+
+void NepaliRomanEngine::watchLatency(NepaliRomanState *state, InputContext *ic,
+                                     uint64_t latencyUs) {
+    auto &watchdog = state->watchdog_;
+    watchdog.setBudget(keyLatencyBudgetMs_ * 1000ULL);
+    switch (watchdog.record(latencyUs)) {
+    case LatencyWatchdog::Transition::Degraded:
+        FCITX_INFO() << "Lekhika: keys take " << watchdog.p95() / 1000.0
+                     << " ms (p95) in " << ic->program()
+                     << ", pausing suggestions, learning and prefetch";
+        break;
+    case LatencyWatchdog::Transition::Recovered:
+        FCITX_INFO() << "Lekhika: keys take " << watchdog.p95() / 1000.0
+                     << " ms (p95) in " << ic->program()
+                     << ", resuming suggestions, learning and prefetch";
+        break;
+    case LatencyWatchdog::Transition::None:
+        break;
+    }
+}
+
+void NepaliRomanEngine::handleKey(NepaliRomanState *state, KeyEvent &keyEvent) {
+    auto *ic = keyEvent.inputContext();
     auto candidateList = ic->inputPanel().candidateList();
     bool isCandidateListVisible = static_cast<bool>(candidateList);
 
     const auto &sym = keyEvent.key().sym();
     const auto &key = keyEvent.key();
 
+    // Transliterate selected text in place, or turn it back into Roman
+    if (state->buffer_.empty() && state->sentence_.empty() &&
+        (key.checkKeyList(convertSelectionKey_) ||
+         key.checkKeyList(romanizeSelectionKey_))) {
+        if (convertSelection(ic, key.checkKeyList(romanizeSelectionKey_))) {
+            keyEvent.filterAndAccept();
+        }
+        return;
+    }
+
+    // Take back the last commit and compose it again
+    if (state->buffer_.empty() && state->sentence_.empty() &&
+        key.checkKeyList(undoCommitKey_)) {
+        if (undoCommit(state, ic)) {
+            keyEvent.filterAndAccept();
+        }
+        return;
+    }
+
     // Candidate selection logic
     if (isCandidateListVisible) {
         // Commit with Space if option enabled OR user navigated in candidates
         if (sym == FcitxKey_space &&
             (spacecanCommitSuggestions_ || state->navigatedInCandidates_)) {
             if (candidateList->cursorIndex() >= 0) {
-                const auto &word =
-                    candidateList->candidate(candidateList->cursorIndex())
-                        .text()
-                        .toString();
-                ic->commitString(word + " ");
-                resetState(state, ic);
-                state->navigatedInCandidates_ = false;
+                commitCandidate(state, ic, candidateList->cursorIndex());
                 keyEvent.filterAndAccept();
                 return;
             }
@@ -166,16 +571,24 @@ void NepaliRomanEngine::keyEvent(const InputMethodEntry &, KeyEvent &keyEvent) {
             ? candidateList->cursorIndex()
             : (sym - FcitxKey_1);
             if (index >= 0 && index < candidateList->size()) {
-                const auto &word =
-                    candidateList->candidate(index).text().toString();
-                ic->commitString(word + " ");
-                resetState(state, ic);
+                commitCandidate(state, ic, index);
+                // Enter also ends a sentence
+                if (sym == FcitxKey_Return && !state->sentence_.empty()) {
+                    commitBuffer(state, ic);
+                }
                 keyEvent.filterAndAccept();
                 return;
             }
         }
     }
 
+    // Tab, or Right at the end of the buffer, takes the inline completion
+    if ((sym == FcitxKey_Tab || sym == FcitxKey_Right) &&
+        acceptCompletion(state, ic)) {
+        keyEvent.filterAndAccept();
+        return;
+    }
+
     // Move cursor
     if (sym == FcitxKey_Left) {
         if (!state->buffer_.empty() && state->cursorPos_ > 0) {
@@ -229,26 +642,15 @@ void NepaliRomanEngine::keyEvent(const InputMethodEntry &, KeyEvent &keyEvent) {
         if (isCandidateListVisible) {
             auto candidateList = ic->inputPanel().candidateList();
             if (candidateList && candidateList->cursorIndex() >= 0) {
-                const auto &word =
-                    candidateList->candidate(candidateList->cursorIndex())
-                        .text()
-                        .toString();
-                ic->commitString(word + " ");
-                resetState(state, ic);
+                commitCandidate(state, ic, candidateList->cursorIndex());
                 committed = true;
             }
         }
 
-        // If no candidate committed, try buffer
-        if (!committed && !state->buffer_.empty()) {
-            std::string result = transliterator_->transliterate(state->buffer_);
-            ic->commitString(result);
-#ifdef HAVE_SQLITE3
-            if (dictionary_ && enableDictionaryLearning_) {
-                dictionary_->addWord(result);
-            }
-#endif
-            resetState(state, ic);
+        // If no candidate committed, try buffer; a sentence goes out whole
+        if ((!committed && !state->buffer_.empty()) ||
+            !state->sentence_.empty()) {
+            commitBuffer(state, ic);
             committed = true;
         }
 
@@ -261,50 +663,56 @@ void NepaliRomanEngine::keyEvent(const InputMethodEntry &, KeyEvent &keyEvent) {
 
     // Space: commit candidate if allowed, else commit buffer or insert space
     if (sym == FcitxKey_space) {
+        // A symbol search commits the highlighted symbol and eats the Space
+        if (isSymbolQuery(state->buffer_) && isCandidateListVisible &&
+            candidateList->cursorIndex() >= 0) {
+            commitCandidate(state, ic, candidateList->cursorIndex());
+            keyEvent.filterAndAccept();
+            return;
+        }
         if (spacecanCommitSuggestions_ && isCandidateListVisible) {
             auto candidateList = ic->inputPanel().candidateList();
             if (candidateList && candidateList->cursorIndex() >= 0) {
-                const auto &word =
-                    candidateList->candidate(candidateList->cursorIndex())
-                        .text()
-                        .toString();
-                ic->commitString(word + " ");
-                resetState(state, ic);
-                state->navigatedInCandidates_ = false;
-                // Do NOT consume — let Space reach app for the space
+                commitCandidate(state, ic, candidateList->cursorIndex());
+                // Do NOT consume — let Space reach app for the space,
+                // unless the word only joined the sentence
+                if (sentenceMode_) {
+                    keyEvent.filterAndAccept();
+                }
                 return;
             }
         }
-        // Fallback: commit buffer or insert space
-        if (!state->buffer_.empty()) {
-            std::string result = transliterator_->transliterate(state->buffer_);
-            ic->commitString(result);
-#ifdef HAVE_SQLITE3
-            if (dictionary_ && enableDictionaryLearning_) {
-                dictionary_->addWord(result);
-            }
-#endif
-            resetState(state, ic);
-            //  Do NOT consume — let Space reach app
+        // In sentence mode the word joins the sentence and Space is kept
+        if (sentenceMode_ && !state->buffer_.empty()) {
+            bool learned = false;
+            std::string word = finishBuffer(state, &learned);
+            appendSentenceWord(state, ic, word + " ", learned);
+            keyEvent.filterAndAccept();
             return;
-        } else {
-            // Do NOT consume — let Space reach app
+        }
+        if (sentenceMode_ && !state->sentence_.empty()) {
+            keyEvent.filterAndAccept();
             return;
         }
+        // Fallback: commit buffer; either way let Space reach the app
+        commitBuffer(state, ic);
+        return;
     }
 
     // Esc: commit raw buffer as-is (no transliteration) and reset
     if (sym == FcitxKey_Escape) {
-        if (!state->buffer_.empty()) {
-            ic->commitString(state->buffer_);
-            resetState(state, ic);
-        }
+        commitRawBuffer(state, ic);
         keyEvent.filterAndAccept();
         return;
     }
 
     // Backspace
     if (sym == FcitxKey_BackSpace) {
+        if (state->buffer_.empty() && !state->sentence_.empty()) {
+            editSentenceWord(state, ic);
+            keyEvent.filterAndAccept();
+            return;
+        }
         if (!state->buffer_.empty() && state->cursorPos_ > 0) {
             state->buffer_.erase(state->cursorPos_ - 1, 1);
             state->cursorPos_--;
@@ -318,15 +726,45 @@ void NepaliRomanEngine::keyEvent(const InputMethodEntry &, KeyEvent &keyEvent) {
     if (key.isSimple()) {
         std::string chr = key.keySymToUTF8(fcitx::KeySym(sym));
 
-        static const std::string commitSymbols =
-            R"(!@#$%^()-_=+[]{};:'",.<>?|\\)";
-        bool isCommitSymbol = commitSymbols.find(chr) != std::string::npos;
+        bool isCommitSymbol =
+            chr.length() == 1 && lekhika::isCommitSymbol(chr[0]);
         bool isNumber = chr.length() == 1 && std::isdigit(chr[0]);
 
+        // A search starts with a letter; in "10:30" or ": " the ':' is
+        // plain text, and the key after it is typed as usual
+        if (state->buffer_ == ":" &&
+            !(chr.size() == 1 && std::isalpha(static_cast<unsigned char>(chr[0])))) {
+            commitBuffer(state, ic);
+        }
+        // ':' on an empty buffer starts a symbol search; everything typed
+        // after it is the query, and another ':' picks the highlighted one
+        if (enableSymbolPicker_ && chr == ":" && state->buffer_.empty()) {
+            state->buffer_ = chr;
+            state->cursorPos_ = chr.length();
+            updatePreedit(ic);
+            keyEvent.filterAndAccept();
+            return;
+        }
+        if (isSymbolQuery(state->buffer_) && !chr.empty()) {
+            if (chr == ":") {
+                if (isCandidateListVisible && candidateList->cursorIndex() >= 0) {
+                    commitCandidate(state, ic, candidateList->cursorIndex());
+                } else {
+                    commitBuffer(state, ic);
+                }
+            } else {
+                state->buffer_.insert(state->cursorPos_, chr);
+                state->cursorPos_ += chr.length();
+                updatePreedit(ic);
+            }
+            keyEvent.filterAndAccept();
+            return;
+        }
+
         if (chr == "/") {
             commitBuffer(state, ic);
             ic->commitString(enableSymbolsTransliteration_
-                                 ? transliterator_->transliterate(chr)
+                                 ? transliterate(chr)
                                  : chr);
             keyEvent.filterAndAccept();
             return;
@@ -337,7 +775,7 @@ void NepaliRomanEngine::keyEvent(const InputMethodEntry &, KeyEvent &keyEvent) {
             std::string symbolResult = chr;
             if ((isNumber && enableIndicNumbers_) ||
                 (isCommitSymbol && enableSymbolsTransliteration_)) {
-                symbolResult = transliterator_->transliterate(chr);
+                symbolResult = transliterate(chr);
             }
             ic->commitString(symbolResult);
             updatePreedit(ic);
@@ -347,101 +785,1506 @@ void NepaliRomanEngine::keyEvent(const InputMethodEntry &, KeyEvent &keyEvent) {
 
         state->buffer_.insert(state->cursorPos_, chr);
         state->cursorPos_ += chr.length();
+        commitStablePrefix(state, ic);
         updatePreedit(ic);
+        if (state->cursorPos_ == state->buffer_.length() &&
+            !isSymbolQuery(state->buffer_) && !state->watchdog_.degraded()) {
+            schedulePrefetch(state->buffer_);
+        }
         keyEvent.filterAndAccept();
     }
 }
 
-void NepaliRomanEngine::commitBuffer(NepaliRomanState *state, InputContext *ic) {
-    if (!state->buffer_.empty()) {
-        std::string result = transliterator_->transliterate(state->buffer_);
-        ic->commitString(result);
-#ifdef HAVE_SQLITE3
-        if (dictionary_ && enableDictionaryLearning_) {
-            dictionary_->addWord(result);
+const KeyboardLayout *
+NepaliRomanEngine::layoutFor(const InputMethodEntry &entry) {
+    const std::string &name = entry.uniqueName();
+    if (!isLayoutInputMethod(name)) {
+        return nullptr;
+    }
+    auto &layout = layouts_[name];
+    if (!layout) {
+        // The shipped layout first, so the user's file can change keys
+        layout = std::make_unique<KeyboardLayout>();
+        std::string file =
+            name.substr(sizeof(kLayoutInputMethodPrefix) - 1) + ".txt";
+        auto systemLayout = StandardPath::global().locate(
+            StandardPath::Type::PkgData, kLayoutDir + file);
+        if (!systemLayout.empty()) {
+            layout->load(systemLayout);
+        }
+        auto userLayout = lekhikaDataPath("layouts/" + file);
+        if (fs::isreg(userLayout)) {
+            layout->load(userLayout);
+        }
+        if (layout->empty()) {
+            FCITX_WARN() << "Lekhika: no keys in layout " << file;
         }
-#endif
-        resetState(state, ic);
     }
+    return layout.get();
 }
 
-void NepaliRomanEngine::commitRawBuffer(NepaliRomanState *state, InputContext *ic) {
-    if (!state->buffer_.empty()) {
-        ic->commitString(state->buffer_);
-        resetState(state, ic);
+// Keyboard layouts commit every key at once. The only state is the word
+// typed so far, which suggestions complete.
+void NepaliRomanEngine::handleLayoutKey(const KeyboardLayout &layout,
+                                        NepaliRomanState *state,
+                                        KeyEvent &keyEvent) {
+    auto *ic = keyEvent.inputContext();
+    const auto &key = keyEvent.key();
+    const auto sym = key.sym();
+
+    auto candidateList = ic->inputPanel().candidateList();
+    if (candidateList && candidateList->size() > 0) {
+        // Digits are letters in these layouts, so Tab, or Enter after
+        // choosing with the arrows, takes a suggestion
+        if (sym == FcitxKey_Tab ||
+            (sym == FcitxKey_Return && state->navigatedInCandidates_)) {
+            commitLayoutCandidate(state, ic, candidateList->cursorIndex());
+            keyEvent.filterAndAccept();
+            return;
+        }
+        if (sym == FcitxKey_Up || sym == FcitxKey_Down) {
+            int total = candidateList->size();
+            int step = sym == FcitxKey_Up ? total - 1 : 1;
+            static_cast<LekhikaCandidateList *>(candidateList.get())
+                ->setCursorIndex((candidateList->cursorIndex() + step) % total);
+            state->navigatedInCandidates_ = true;
+            ic->updateUserInterface(UserInterfaceComponent::InputPanel);
+            keyEvent.filterAndAccept();
+            return;
+        }
+    }
+
+    if (sym == FcitxKey_BackSpace && !state->layoutWord_.empty()) {
+        // The application deletes the last character; follow it
+        auto &word = state->layoutWord_;
+        size_t last = word.size() - 1;
+        while (last > 0 && (static_cast<unsigned char>(word[last]) & 0xC0) == 0x80) {
+            --last;
+        }
+        word.erase(last);
+        updateLayoutCandidates(state, ic);
+        return;
+    }
+
+    const std::string *text = key.isSimple() ? layout.map(sym) : nullptr;
+    if (!text) {
+        // Space, Enter, shortcuts: the word is over and the key is the
+        // application's
+        endLayoutWord(state, ic);
+        return;
+    }
+    ic->commitString(*text);
+    keyEvent.filterAndAccept();
+    if (isWordText(*text)) {
+        state->layoutWord_ += *text;
+        updateLayoutCandidates(state, ic);
+    } else {
+        endLayoutWord(state, ic);
     }
 }
 
-void NepaliRomanEngine::resetState(NepaliRomanState *state, InputContext *ic) {
-    state->buffer_.clear();
-    state->cursorPos_ = 0;
+void NepaliRomanEngine::updateLayoutCandidates(NepaliRomanState *state,
+                                               InputContext *ic) {
+    const std::string &word = state->layoutWord_;
     state->navigatedInCandidates_ = false;
-    updatePreedit(ic);
+    std::unique_ptr<LekhikaCandidateList> cands;
+    if (layoutSuggestions_ && enableSuggestion_ &&
+        !state->watchdog_.degraded() && !word.empty()) {
+        cands = std::make_unique<LekhikaCandidateList>(horizontalLayout_);
+        // Only completions: what is typed is already in the application
+        for (auto &w : lookupSuggestions(dictionaryQuery(word),
+                                         std::max(1, suggestionLimit_),
+                                         lookupDeadline())) {
+            if (w.size() > word.size() && w.compare(0, word.size(), word) == 0 &&
+                lekhika::validateUtf8(w) &&
+                !(lekhika::classifyScript(w) & lekhika::ScriptOther)) {
+                cands->append(
+                    std::make_unique<LekhikaCandidateWord>(Text(std::move(w)), this));
+            }
+        }
+        if (cands->empty()) {
+            cands.reset();
+        }
+    }
+    ic->inputPanel().setCandidateList(std::move(cands));
+    ic->updateUserInterface(UserInterfaceComponent::InputPanel);
 }
 
-void NepaliRomanEngine::deactivate(const InputMethodEntry &,
-                                   InputContextEvent &event) {
-    auto *ic = event.inputContext();
-    auto *state = ic->propertyFor(&factory_);
-    commitRawBuffer(state, ic);
+void NepaliRomanEngine::commitLayoutCandidate(NepaliRomanState *state,
+                                              InputContext *ic, int index) {
+    auto candidateList = ic->inputPanel().candidateList();
+    if (!candidateList || index < 0 || index >= candidateList->size()) {
+        return;
+    }
+    const std::string &typed = state->layoutWord_;
+    std::string word =
+        lekhika::toNfc(candidateList->candidate(index).text().toString());
+    if (word.compare(0, typed.size(), typed) != 0) {
+        return;
+    }
+    recordSelection(typed, word, index);
+    ic->commitString(word.substr(typed.size()) + " ");
+    state->layoutWord_.clear();
+    endLayoutWord(state, ic);
 }
 
-void NepaliRomanEngine::reset(const InputMethodEntry &entry,
-                              InputContextEvent &event) {
-    deactivate(entry, event);
+void NepaliRomanEngine::endLayoutWord(NepaliRomanState *state,
+                                      InputContext *ic) {
+    if (!state->layoutWord_.empty()) {
+        rememberRecent(state->layoutWord_);
+        state->layoutWord_.clear();
+    }
+    state->navigatedInCandidates_ = false;
+    if (ic->inputPanel().candidateList()) {
+        ic->inputPanel().setCandidateList(nullptr);
+        ic->updateUserInterface(UserInterfaceComponent::InputPanel);
+    }
 }
 
-void NepaliRomanEngine::updatePreedit(InputContext *ic) {
-    auto *state = ic->propertyFor(&factory_);
-    Text preedit;
-    Text aux;
-
-    if (!state->buffer_.empty()) {
-        std::string preview_full =
-            transliterator_->transliterate(state->buffer_);
-        std::string preview_before_cursor = transliterator_->transliterate(
-            state->buffer_.substr(0, state->cursorPos_));
-        size_t cursor_in_preview_bytes = preview_before_cursor.length();
-        preedit.append(preview_full, TextFormatFlag::Underline);
-        preedit.setCursor(cursor_in_preview_bytes);
-        aux.append(state->buffer_ + "⇾" + preview_before_cursor);
+void NepaliRomanEngine::commitCandidate(NepaliRomanState *state,
+                                        InputContext *ic, int index) {
+    auto candidateList = ic->inputPanel().candidateList();
+    if (!candidateList || index < 0 || index >= candidateList->size()) {
+        return;
     }
-
-    ic->inputPanel().setClientPreedit(preedit);
-    ic->inputPanel().setAuxUp(aux);
-
-    updateCandidates(ic, ic->propertyFor(&factory_)->buffer_);
-    ic->updatePreedit();
-    ic->updateUserInterface(UserInterfaceComponent::InputPanel);
+    if (!state->segmentEdits_.empty()) {
+        applySegmentEdit(state, ic, index);
+        return;
+    }
+    if (state->buffer_.empty() && !state->layoutWord_.empty()) {
+        commitLayoutCandidate(state, ic, index);
+        return;
+    }
+    // Words get a separating space; symbols usually sit inside text
+    std::string text =
+        lekhika::toNfc(candidateList->candidate(index).text().toString());
+    CandidatePick pick;
+    if (!isSymbolQuery(state->buffer_)) {
+        // Only Nepali words are ranked; English, symbols and snippets,
+        // which are the user's own text, are not
+        auto snippets = snippetCandidates(state->buffer_);
+        bool isSnippet = std::any_of(
+            snippets.begin(), snippets.end(),
+            [&text](const std::string &s) { return lekhika::toNfc(s) == text; });
+        if (lekhika::classifyScript(text) == lekhika::ScriptDevanagari &&
+            !isSnippet && !state->watchdog_.degraded()) {
+            pick = recordSelection(transliterateBuffer(state->buffer_), text,
+                                   index);
+        }
+        text += " ";
+    }
+    bool learned = pick.learn;
+    if (sentenceMode_) {
+        appendSentenceWord(state, ic, std::move(text), learned, std::move(pick));
+        return;
+    }
+    ic->commitString(text);
+    recordCommit(state, ic, std::move(text), learned, std::move(pick));
+    resetState(state, ic);
 }
 
-void NepaliRomanEngine::updateCandidates(InputContext *ic,
-                                         const std::string &buffer) {
-    ic->inputPanel().setCandidateList(nullptr); // clear old list
-#ifdef HAVE_SQLITE3
-    if (!dictionary_ || buffer.empty() || !enableSuggestion_)
+void NepaliRomanEngine::selectCandidate(InputContext *ic,
+                                        const CandidateWord *word) {
+    auto candidateList = ic->inputPanel().candidateList();
+    if (!candidateList) {
         return;
+    }
+    for (int i = 0; i < candidateList->size(); ++i) {
+        if (&candidateList->candidate(i) == word) {
+            commitCandidate(ic->propertyFor(&factory_), ic, i);
+            return;
+        }
+    }
+}
 
-    std::string prefix = transliterator_->transliterate(buffer);
-    int limit = std::max(1, suggestionLimit_);
-    std::vector<std::string> words = dictionary_->findWords(prefix, limit);
-
-    if (words.empty())
+void NepaliRomanEngine::commitBuffer(NepaliRomanState *state, InputContext *ic) {
+    // A sentence goes out in one piece, ending with the word under edit
+    std::string sentence = sentenceText(state);
+    if (isSymbolQuery(state->buffer_)) {
+        // An unfinished search is kept as typed; a lone ':' is just ':'
+        std::string text = state->buffer_ == ":"
+                               ? transliterateText(state->buffer_)
+                               : state->buffer_;
+        ic->commitString(sentence + text);
+        recordCommit(state, ic, std::move(text), false);
+        resetState(state, ic);
         return;
-
-    auto cands = std::make_unique<LekhikaCandidateList>(horizontalLayout_);
-    for (const auto &w : words) {
-        std::string u8 = w;
-        if (!utf8::validate(u8.begin(), u8.end()))
-            continue;
-        cands->append(
-            std::make_unique<LekhikaCandidateWord>(Text(std::move(u8))));
     }
+    if (!state->buffer_.empty()) {
+        bool learned = false;
+        std::string result = finishBuffer(state, &learned);
+        ic->commitString(sentence + result);
+        recordCommit(state, ic, std::move(result), learned);
+        resetState(state, ic);
+    } else if (!sentence.empty()) {
+        ic->commitString(sentence);
+        // Undo takes back the last word, as if it had been typed alone
+        state->history_.push(std::move(state->sentence_.back()));
+        resetState(state, ic);
+    }
+}
 
-    ic->inputPanel().setCandidateList(std::move(cands));
+// The buffer's text as it is committed, learned from like a typed word
+std::string NepaliRomanEngine::finishBuffer(NepaliRomanState *state,
+                                            bool *learned) {
+    const std::string *snippet =
+        (enableSnippets_ && expandSnippetsOnCommit_)
+            ? snippets_.exactMatch(state->buffer_)
+            : nullptr;
+    std::string result =
+        snippet ? *snippet : transliterateBuffer(state->buffer_);
+    keyModel_.observe(state->buffer_);
+    if (!snippet) {
+        rememberRecent(result);
+    }
+    *learned = false;
+#ifdef HAVE_SQLITE3
+    if (dictionary_ && enableDictionaryLearning_ && !snippet &&
+        !state->watchdog_.degraded()) {
+        learnWord(result);
+        *learned = true;
+    }
 #endif
+    return result;
+}
+
+void NepaliRomanEngine::commitRawBuffer(NepaliRomanState *state, InputContext *ic) {
+    if (state->buffer_.empty() && state->sentence_.empty()) {
+        return;
+    }
+    std::string raw;
+    for (const auto &word : state->sentence_) {
+        raw += word.buffer;
+        if (!word.output.empty() && word.output.back() == ' ') {
+            raw += ' ';
+        }
+    }
+    ic->commitString(raw + state->buffer_);
+    if (!state->buffer_.empty()) {
+        recordCommit(state, ic, state->buffer_, false);
+    }
+    resetState(state, ic);
 }
 
+// Sentence mode: every finished word keeps its Roman text, output and
+// candidates, so only the word under edit is ever looked up again.
+void NepaliRomanEngine::appendSentenceWord(NepaliRomanState *state,
+                                           InputContext *ic,
+                                           std::string output, bool learned,
+                                           CandidatePick pick) {
+    CommitRecord word;
+    word.buffer = std::move(state->buffer_);
+    word.output = std::move(output);
+    word.learned = learned;
+    word.pick = std::move(pick);
+    captureCandidates(ic, word);
+    state->sentence_.push_back(std::move(word));
+    state->buffer_.clear();
+    state->cursorPos_ = 0;
+    state->navigatedInCandidates_ = false;
+    updatePreedit(ic);
+}
+
+// Backspace on an empty buffer opens the last word again, as it was
+void NepaliRomanEngine::editSentenceWord(NepaliRomanState *state,
+                                         InputContext *ic) {
+    CommitRecord word = std::move(state->sentence_.back());
+    state->sentence_.pop_back();
+    forgetCommit(word);
+    state->buffer_ = std::move(word.buffer);
+    state->cursorPos_ = state->buffer_.length();
+    state->navigatedInCandidates_ = false;
+    showCandidates(ic, std::move(word.candidates), word.candidateCursor);
+    updatePreedit(ic, false);
+}
+
+void NepaliRomanEngine::showCandidates(InputContext *ic,
+                                       std::vector<std::string> candidates,
+                                       int cursor) {
+    std::unique_ptr<LekhikaCandidateList> cands;
+    if (!candidates.empty()) {
+        cands = std::make_unique<LekhikaCandidateList>(horizontalLayout_);
+        for (auto &candidate : candidates) {
+            cands->append(std::make_unique<LekhikaCandidateWord>(
+                Text(std::move(candidate)), this));
+        }
+        cands->setCursorIndex(std::max(0, cursor));
+    }
+    ic->inputPanel().setCandidateList(std::move(cands));
+}
+
+// Keeps per-key work bounded: once the buffer is past the limit, the part
+// of it that later keys can no longer change is committed.
+void NepaliRomanEngine::commitStablePrefix(NepaliRomanState *state,
+                                           InputContext *ic) {
+    const std::string &buffer = state->buffer_;
+    if (maxComposingLength_ <= 0 ||
+        buffer.size() <= std::max<size_t>(maxComposingLength_, kUnstableTail) ||
+        state->cursorPos_ != buffer.size() || isSymbolQuery(buffer)) {
+        return;
+    }
+    // Only the splits nearest the tail are tried, so a buffer with no stable
+    // split costs a fixed number of transliterations per key rather than
+    // one per letter
+    size_t last = buffer.size() - kUnstableTail;
+    size_t first = last > kMaxStableSplits ? last - kMaxStableSplits : 0;
+    // Compared with raw transliterations, so not the normalized preview
+    std::string output = transliterate(buffer);
+    size_t split = last;
+    std::string head;
+    for (; split > first; --split) {
+        head = transliterate(buffer.substr(0, split));
+        if (output.compare(0, head.size(), head) == 0 &&
+            transliterate(buffer.substr(split)) ==
+                output.substr(head.size())) {
+            break;
+        }
+    }
+    if (split == first) {
+        if (buffer.size() < 2 * static_cast<size_t>(maxComposingLength_)) {
+            return;
+        }
+        // Nothing stable within reach of a buffer this long: commit the
+        // head as it reads now, at the cost of what the tail might have
+        // changed
+        split = last;
+        head = transliterate(buffer.substr(0, split));
+    }
+    // Not a word, so it is neither learned nor kept for undo
+    head = lekhika::toNfc(std::move(head));
+    if (sentenceMode_) {
+        CommitRecord part;
+        part.buffer = buffer.substr(0, split);
+        part.output = std::move(head);
+        state->sentence_.push_back(std::move(part));
+    } else {
+        ic->commitString(head);
+    }
+    state->buffer_.erase(0, split);
+    state->cursorPos_ = state->buffer_.size();
+}
+
+bool NepaliRomanEngine::acceptCompletion(NepaliRomanState *state,
+                                         InputContext *ic) {
+    if (state->completion_.empty() ||
+        state->cursorPos_ != state->buffer_.length()) {
+        return false;
+    }
+    CandidatePick pick = recordSelection(transliterateBuffer(state->buffer_),
+                                         state->completion_, 0);
+    std::string text = lekhika::toNfc(state->completion_) + " ";
+    bool learned = pick.learn;
+    if (sentenceMode_) {
+        appendSentenceWord(state, ic, std::move(text), learned, std::move(pick));
+        return true;
+    }
+    ic->commitString(text);
+    recordCommit(state, ic, std::move(text), learned, std::move(pick));
+    resetState(state, ic);
+    return true;
+}
+
+void NepaliRomanEngine::resetState(NepaliRomanState *state, InputContext *ic) {
+    state->buffer_.clear();
+    state->cursorPos_ = 0;
+    state->navigatedInCandidates_ = false;
+    updatePreedit(ic);
+}
+
+void NepaliRomanEngine::recordCommit(NepaliRomanState *state, InputContext *ic,
+                                     std::string output, bool learned,
+                                     CandidatePick pick) {
+    CommitRecord record;
+    record.buffer = state->buffer_;
+    record.output = std::move(output);
+    record.learned = learned;
+    record.pick = std::move(pick);
+    captureCandidates(ic, record);
+    state->history_.push(std::move(record));
+}
+
+bool NepaliRomanEngine::undoCommit(NepaliRomanState *state, InputContext *ic) {
+    if (state->history_.empty() ||
+        !ic->capabilityFlags().test(CapabilityFlag::SurroundingText)) {
+        return false;
+    }
+    const auto &surrounding = ic->surroundingText();
+    if (!surrounding.isValid() || surrounding.cursor() != surrounding.anchor()) {
+        return false;
+    }
+    const std::string &text = surrounding.text();
+    std::string before = text.substr(
+        0, utf8::ncharByteLength(text.begin(), surrounding.cursor()));
+    auto endsWith = [&before](const std::string &tail) {
+        return before.size() >= tail.size() &&
+               before.compare(before.size() - tail.size(), tail.size(),
+                              tail) == 0;
+    };
+
+    // Only undo text that is still right before the cursor; the Space that
+    // committed a buffer reaches the application after the word
+    CommitRecord record = state->history_.pop();
+    std::string committed = record.output;
+    if (endsWith(committed + " ")) {
+        committed += " ";
+    } else if (!endsWith(committed)) {
+        state->history_.clear();
+        return false;
+    }
+    auto length = static_cast<int>(utf8::length(committed));
+    ic->deleteSurroundingText(-length, static_cast<unsigned int>(length));
+    forgetCommit(record);
+
+    // Restore the composition as it was, without looking anything up again
+    state->buffer_ = std::move(record.buffer);
+    state->cursorPos_ = state->buffer_.length();
+    state->navigatedInCandidates_ = false;
+    showCandidates(ic, std::move(record.candidates), record.candidateCursor);
+    updatePreedit(ic, false);
+    return true;
+}
+
+// Takes back what a commit taught the ranking: the learned word and the
+// boost of a picked candidate
+void NepaliRomanEngine::forgetCommit(const CommitRecord &record) {
+    std::string word = record.output;
+    if (!word.empty() && word.back() == ' ') {
+        word.pop_back();
+    }
+    if (record.pick.boost > 0) {
+        boosts_.add(record.pick.prefix, record.pick.word, -record.pick.boost);
+#ifdef HAVE_SQLITE3
+        if (store_) {
+            store_->addSelection(record.pick.prefix, record.pick.word,
+                                 -record.pick.boost);
+        }
+#endif
+        speculative_.clearSuggestions();
+        queries_.clear();
+        completions_.clear();
+    }
+#ifdef HAVE_SQLITE3
+    if (record.learned && store_) {
+        learnWord(word, -1);
+    }
+#endif
+}
+
+void NepaliRomanEngine::deactivate(const InputMethodEntry &,
+                                   InputContextEvent &event) {
+    auto *ic = event.inputContext();
+    auto *state = ic->propertyFor(&factory_);
+    // Finished words of a sentence keep the spelling picked for them
+    if (!state->sentence_.empty()) {
+        ic->commitString(sentenceText(state));
+        state->sentence_.clear();
+        if (state->buffer_.empty()) {
+            resetState(state, ic);
+        }
+    }
+    commitRawBuffer(state, ic);
+    endLayoutWord(state, ic);
+    // The cursor may be anywhere once the context comes back
+    state->history_.clear();
+}
+
+void NepaliRomanEngine::reset(const InputMethodEntry &entry,
+                              InputContextEvent &event) {
+    deactivate(entry, event);
+}
+
+void NepaliRomanEngine::updatePreedit(InputContext *ic, bool refreshCandidates) {
+    auto *state = ic->propertyFor(&factory_);
+    Text preedit;
+    Text aux;
+    state->completion_.clear();
+
+    // Finished words of a sentence come first, as they will be committed
+    size_t sentenceBytes = 0;
+    for (const auto &word : state->sentence_) {
+        preedit.append(word.output, TextFormatFlag::Underline);
+        sentenceBytes += word.output.size();
+    }
+    preedit.setCursor(sentenceBytes);
+
+    if (isSymbolQuery(state->buffer_)) {
+        preedit.append(state->buffer_, TextFormatFlag::Underline);
+        preedit.setCursor(sentenceBytes + state->cursorPos_);
+        aux.append(state->buffer_);
+    } else if (!state->buffer_.empty()) {
+        std::string preview_full = transliterateBuffer(state->buffer_);
+        std::string preview_before_cursor =
+            state->cursorPos_ == state->buffer_.length()
+                ? preview_full
+                : transliterate(
+                      state->buffer_.substr(0, state->cursorPos_));
+        size_t cursor_in_preview_bytes = preview_before_cursor.length();
+        preedit.append(preview_full, TextFormatFlag::Underline);
+        preedit.setCursor(sentenceBytes + cursor_in_preview_bytes);
+        aux.append(state->buffer_ + "⇾" + preview_before_cursor);
+
+        if (showInlineCompletion_ && enableSuggestion_ &&
+            !state->watchdog_.degraded() &&
+            state->cursorPos_ == state->buffer_.length() &&
+            englishScore(state->buffer_) == EnglishWordModel::Unknown) {
+            std::string word = topCompletion(preview_full);
+            if (!word.empty()) {
+                // Shown for reference only; never part of a commit
+                preedit.append(word.substr(preview_full.size()),
+                               {TextFormatFlag::Italic,
+                                TextFormatFlag::DontCommit});
+                state->completion_ = std::move(word);
+            }
+        }
+    }
+
+    ic->inputPanel().setClientPreedit(preedit);
+    ic->inputPanel().setAuxUp(aux);
+
+    if (refreshCandidates) {
+        state->segmentEdits_.clear();
+        if (!updateSegmentCandidates(state, ic)) {
+            updateCandidates(ic, state->buffer_);
+        }
+    }
+    ic->updatePreedit();
+    ic->updateUserInterface(UserInterfaceComponent::InputPanel);
+}
+
+void NepaliRomanEngine::updateCandidates(InputContext *ic,
+                                         const std::string &buffer) {
+    ic->inputPanel().setCandidateList(nullptr); // clear old list
+    if (buffer.empty())
+        return;
+
+    if (isSymbolQuery(buffer)) {
+        std::string query = buffer.substr(1);
+        if (query.empty())
+            return;
+        auto symbols = symbols_->search(
+            {query, transliterate(query)},
+            static_cast<size_t>(std::max(1, suggestionLimit_)));
+        if (symbols.empty())
+            return;
+        auto cands = std::make_unique<LekhikaCandidateList>(horizontalLayout_);
+        for (auto &symbol : symbols) {
+            cands->append(std::make_unique<LekhikaCandidateWord>(
+                Text(std::move(symbol)), this));
+        }
+        ic->inputPanel().setCandidateList(std::move(cands));
+        return;
+    }
+
+    // Snippets are the user's own text: always first, never filtered
+    auto cands = std::make_unique<LekhikaCandidateList>(horizontalLayout_);
+    std::vector<std::string> shown = snippetCandidates(buffer);
+    for (const auto &text : shown) {
+        cands->append(std::make_unique<LekhikaCandidateWord>(Text(text), this));
+    }
+
+    auto english = englishScore(buffer);
+    // A common English word of some length is almost never also Roman
+    // Nepali, so the dictionary would only add noise and latency
+    bool englishOnly = english >= EnglishWordModel::Common &&
+                       buffer.size() >= kEnglishOnlyLength;
+    // While this context is slow only the cheap candidates are shown
+    bool degraded = ic->propertyFor(&factory_)->watchdog_.degraded();
+
+    size_t dictionaryWords = 0;
+    if (enableSuggestion_ && !englishOnly && !degraded) {
+        auto &entry = speculative_.insert(buffer);
+        if (!entry.hasSuggestions) {
+            if (entry.preview.empty()) {
+                entry.preview =
+                    lekhika::toNfc(transliterate(buffer));
+            }
+            // A list cut short is shown now and finished after this key
+            if (!fillSuggestions(entry, lookupDeadline())) {
+                scheduleRefine(ic, buffer);
+            }
+        }
+        for (const auto &w : entry.suggestions) {
+            // Skip broken rows and words the dictionary picked up from
+            // non-Devanagari text
+            if (!lekhika::validateUtf8(w) ||
+                (lekhika::classifyScript(w) & lekhika::ScriptOther) ||
+                std::find(shown.begin(), shown.end(), w) != shown.end())
+                continue;
+            cands->append(std::make_unique<LekhikaCandidateWord>(Text(w), this));
+            shown.push_back(w);
+            ++dictionaryWords;
+        }
+    }
+
+    // Nothing known starts like this: offer other readings of the spelling
+    if (offerSpellingVariants_ && dictionaryWords == 0 && !englishOnly &&
+        !degraded) {
+        auto &entry = speculative_.insert(buffer);
+        if (!entry.hasVariants) {
+            if (entry.preview.empty()) {
+                entry.preview =
+                    lekhika::toNfc(transliterate(buffer));
+            }
+            for (const auto &roman : lattice_.search(
+                     buffer, static_cast<size_t>(std::max(1, suggestionLimit_)))) {
+                std::string variant = transliterate(roman);
+                if (variant != entry.preview &&
+                    std::find(entry.variants.begin(), entry.variants.end(),
+                              variant) == entry.variants.end()) {
+                    entry.variants.push_back(std::move(variant));
+                }
+            }
+            entry.hasVariants = true;
+        }
+        for (const auto &variant : entry.variants) {
+            if (std::find(shown.begin(), shown.end(), variant) == shown.end()) {
+                cands->append(
+                    std::make_unique<LekhikaCandidateWord>(Text(variant), this));
+            }
+        }
+    }
+
+    // An English word is offered as typed, after the Nepali candidates so
+    // Enter still commits Nepali
+    if (english != EnglishWordModel::Unknown &&
+        std::find(shown.begin(), shown.end(), buffer) == shown.end()) {
+        cands->append(std::make_unique<LekhikaCandidateWord>(Text(buffer), this));
+    }
+    if (cands->empty())
+        return;
+
+    ic->inputPanel().setCandidateList(std::move(cands));
+}
+
+// With the cursor inside the buffer the candidates are the alternatives of
+// the segment left of it. Each alternative only retransliterates the
+// syllable around that segment and splices it into the cached output.
+bool NepaliRomanEngine::updateSegmentCandidates(NepaliRomanState *state,
+                                                InputContext *ic) {
+    const std::string &buffer = state->buffer_;
+    size_t cursor = state->cursorPos_;
+    if (cursor == 0 || cursor >= buffer.size() || isSymbolQuery(buffer)) {
+        return false;
+    }
+    const VariantLattice::Segment *segment = nullptr;
+    for (const auto &candidate : lattice_.segment(buffer)) {
+        if (candidate.begin < cursor &&
+            cursor <= candidate.begin + candidate.length) {
+            segment = &candidate;
+            break;
+        }
+    }
+    if (!segment || segment->count == 0) {
+        return false;
+    }
+
+    // The syllable: consonants leading into the segment, vowels after it
+    auto isVowel = [](char c) { return c && std::strchr("aeiouAEIOU", c); };
+    auto isConsonant = [&isVowel](char c) {
+        return std::isalpha(static_cast<unsigned char>(c)) && !isVowel(c);
+    };
+    size_t start = segment->begin;
+    while (start > 0 && isConsonant(buffer[start - 1])) {
+        --start;
+    }
+    size_t segmentEnd = segment->begin + segment->length;
+    size_t end = segmentEnd;
+    while (end < buffer.size() && isVowel(buffer[end])) {
+        ++end;
+    }
+    size_t head = alignedOffset(state, start);
+    size_t tail = alignedOffset(state, end);
+    const std::string &output = state->alignment_.output;
+    // Splicing is only safe if the syllable alone gives the same text as
+    // it does inside the word; the word's output is NFC, so is the syllable
+    bool local = tail >= head &&
+                 lekhika::toNfc(transliterate(buffer.substr(
+                     start, end - start))) == output.substr(head, tail - head);
+
+    std::vector<SegmentEdit> edits{{buffer, output, cursor}};
+    for (size_t i = 0; i < segment->count; ++i) {
+        std::string alternative = segment->alternatives[i].roman;
+        SegmentEdit edit;
+        edit.buffer = buffer.substr(0, segment->begin) + alternative +
+                      buffer.substr(segmentEnd);
+        edit.cursor = segment->begin + alternative.size();
+        if (local) {
+            edit.output =
+                output.substr(0, head) +
+                transliterate(
+                    buffer.substr(start, segment->begin - start) + alternative +
+                    buffer.substr(segmentEnd, end - segmentEnd)) +
+                output.substr(tail);
+        } else {
+            edit.output = transliterate(edit.buffer);
+        }
+        // Committed, learned and cached as the buffer's preview: NFC like
+        // every other output
+        edit.output = lekhika::toNfc(std::move(edit.output));
+        if (std::none_of(edits.begin(), edits.end(),
+                         [&edit](const SegmentEdit &e) {
+                             return e.output == edit.output;
+                         })) {
+            edits.push_back(std::move(edit));
+        }
+    }
+    if (edits.size() < 2) {
+        return false;
+    }
+
+    auto cands = std::make_unique<LekhikaCandidateList>(horizontalLayout_);
+    for (const auto &edit : edits) {
+        cands->append(
+            std::make_unique<LekhikaCandidateWord>(Text(edit.output), this));
+    }
+    ic->inputPanel().setCandidateList(std::move(cands));
+    state->segmentEdits_ = std::move(edits);
+    return true;
+}
+
+size_t NepaliRomanEngine::alignedOffset(NepaliRomanState *state,
+                                        size_t romanPos) {
+    auto &alignment = state->alignment_;
+    if (alignment.buffer != state->buffer_) {
+        alignment.buffer = state->buffer_;
+        alignment.output = transliterateBuffer(state->buffer_);
+        alignment.offsets.clear();
+    }
+    if (romanPos >= alignment.buffer.size()) {
+        return alignment.output.size();
+    }
+    for (const auto &offset : alignment.offsets) {
+        if (offset.first == romanPos) {
+            return offset.second;
+        }
+    }
+    // The part of the prefix's output that survives in the whole output
+    std::string prefix =
+        transliterate(alignment.buffer.substr(0, romanPos));
+    const std::string &output = alignment.output;
+    size_t common = 0;
+    while (common < prefix.size() && common < output.size() &&
+           prefix[common] == output[common]) {
+        ++common;
+    }
+    while (common > 0 && common < output.size() &&
+           (static_cast<unsigned char>(output[common]) & 0xC0) == 0x80) {
+        --common;
+    }
+    alignment.offsets.emplace_back(romanPos, common);
+    return common;
+}
+
+void NepaliRomanEngine::applySegmentEdit(NepaliRomanState *state,
+                                         InputContext *ic, int index) {
+    if (index < 0 || index >= static_cast<int>(state->segmentEdits_.size())) {
+        return;
+    }
+    // The first entry is the word as it stands: take it as it is. In
+    // sentence mode that finishes the word, not the sentence
+    if (index == 0) {
+        if (sentenceMode_ && !state->buffer_.empty() &&
+            !isSymbolQuery(state->buffer_)) {
+            bool learned = false;
+            std::string word = finishBuffer(state, &learned);
+            appendSentenceWord(state, ic, word + " ", learned);
+            return;
+        }
+        commitBuffer(state, ic);
+        return;
+    }
+    SegmentEdit edit = std::move(state->segmentEdits_[index]);
+    // The spliced output stands in for transliterating the new buffer
+    auto &entry = speculative_.insert(edit.buffer);
+    if (entry.preview.empty()) {
+        entry.preview = std::move(edit.output);
+    }
+    state->buffer_ = std::move(edit.buffer);
+    state->cursorPos_ = edit.cursor;
+    state->navigatedInCandidates_ = false;
+    updatePreedit(ic);
+}
+
+// Converts free text the way typing it key by key would: words are
+// transliterated whole, while digits, symbols and whitespace follow the
+// same settings keyEvent applies to them.
+std::string NepaliRomanEngine::transliterateText(const std::string &text) {
+    std::string result;
+    result.reserve(text.size() * 3);
+    for (const auto &run : lekhika::splitRomanRuns(text)) {
+        std::string piece = text.substr(run.begin, run.length);
+        switch (run.kind) {
+        case lekhika::RomanRunKind::Word:
+            result += transliterate(piece);
+            break;
+        case lekhika::RomanRunKind::Digit:
+            result += enableIndicNumbers_
+                          ? transliterate(piece)
+                          : piece;
+            break;
+        case lekhika::RomanRunKind::Symbol:
+            if (!enableSymbolsTransliteration_) {
+                result += piece;
+                break;
+            }
+            // keyEvent sees these one key at a time
+            for (char c : piece) {
+                result += transliterate(std::string(1, c));
+            }
+            break;
+        case lekhika::RomanRunKind::Space:
+            result += piece;
+            break;
+        }
+    }
+    return lekhika::toNfc(std::move(result));
+}
+
+bool NepaliRomanEngine::convertSelection(InputContext *ic, bool romanize) {
+    if (!ic->capabilityFlags().test(CapabilityFlag::SurroundingText)) {
+        return false;
+    }
+    const auto &surrounding = ic->surroundingText();
+    if (!surrounding.isValid() || surrounding.cursor() == surrounding.anchor()) {
+        return false;
+    }
+    std::string selected = surrounding.selectedText();
+    if (selected.empty()) {
+        return false;
+    }
+
+    // Remove the selection ourselves; not every client replaces it on commit
+    int cursor = static_cast<int>(surrounding.cursor());
+    int anchor = static_cast<int>(surrounding.anchor());
+    ic->deleteSurroundingText(std::min(anchor - cursor, 0),
+                              static_cast<unsigned int>(std::abs(anchor - cursor)));
+    ic->commitString(romanize ? lekhika::romanize(selected)
+                              : transliterateText(selected));
+    return true;
+}
+
+std::string NepaliRomanEngine::transliterate(const std::string &roman) {
+    std::string text = transliterator_->transliterate(roman);
+    return variant_ ? variant_->rewrites.apply(text) : text;
+}
+
+std::string NepaliRomanEngine::transliterateBuffer(const std::string &buffer) {
+    auto &entry = speculative_.insert(buffer);
+    if (entry.preview.empty()) {
+        entry.preview =
+            lekhika::toNfc(transliterate(buffer));
+    }
+    return entry.preview;
+}
+
+void NepaliRomanEngine::schedulePrefetch(const std::string &buffer) {
+    // A newer keystroke supersedes any prefetch still pending
+    prefetchEvent_.reset();
+    if (speculativePrefetchKeys_ <= 0 || buffer.empty()) {
+        return;
+    }
+    prefetchEvent_ = instance_->eventLoop().addDeferEvent(
+        [this, buffer](EventSource *) {
+            prefetch(buffer);
+            return true;
+        });
+}
+
+void NepaliRomanEngine::prefetch(const std::string &buffer) {
+    // Runs between keys on the same loop, so all guesses together get one
+    // key's budget; the most likely keys come first
+    uint64_t deadline = lookupDeadline();
+    for (char next : keyModel_.predictNext(buffer, speculativePrefetchKeys_)) {
+        std::string candidate = buffer + next;
+        auto &entry = speculative_.insert(candidate);
+        if (entry.preview.empty()) {
+            entry.preview =
+                lekhika::toNfc(transliterate(candidate));
+        }
+        if (enableSuggestion_ && !entry.hasSuggestions &&
+            !fillSuggestions(entry, deadline)) {
+            break;
+        }
+    }
+}
+
+  //=============================================================================//
+ // Suggestion Sources                                                          //
+//=============================================================================//
+
+void NepaliRomanEngine::setupSuggestionSources() {
+    const auto &paths = StandardPath::global();
+    auto cachePath = [](const std::string &name) {
+        return lekhikaDataPath(std::string("cache/") + name + ".snapshot");
+    };
+
+    // A language variant has its own lists, in a directory named after it
+    std::string dataDir = kLekhikaDataDir;
+    std::string cacheSuffix;
+    if (variant_) {
+        dataDir += "/" + variant_->code;
+        cacheSuffix = "-" + variant_->code;
+    }
+
+    // Tiers are asked cheapest first; later ones are skipped once they
+    // cannot change the result
+#ifdef HAVE_SQLITE3
+    sources_->addSource(std::make_unique<FunctionSource>(
+        kSourceUser, 1.0,
+        [this](const std::string &prefix, size_t limit) {
+            return lookupLearnedWords(prefix, limit);
+        },
+        [this](const std::string &prefix) {
+            return learnedMaxFrequency(prefix);
+        }));
+#endif
+
+    // Optional domain lists (names, places, terms): one source per file.
+    // Only the directory is listed here; each list loads on first use.
+    for (const auto &dir : paths.directories(StandardPath::Type::Data)) {
+        auto domainDir = dir + "/" + dataDir + "/" + kDomainListDir;
+        if (!fs::isdir(domainDir)) {
+            continue;
+        }
+        for (const auto &file : listFiles(domainDir, ".txt")) {
+            auto name = "domain:" + file.substr(0, file.size() - 4);
+            if (!sources_->source(name)) {
+                sources_->addSource(std::make_unique<WordListSource>(
+                    name, 1.0, domainDir + "/" + file,
+                    cachePath(name.substr(7) + cacheSuffix + ".domain")));
+            }
+        }
+    }
+
+    // Base list shipped by the system, or overridden by the user; the
+    // largest, so the last resort
+    auto systemList = paths.locate(StandardPath::Type::Data,
+                                   dataDir + "/" + kSystemWordList);
+    if (!systemList.empty()) {
+        sources_->addSource(std::make_unique<WordListSource>(
+            kSourceSystem, 1.0, systemList,
+            cachePath(kSourceSystem + cacheSuffix)));
+    }
+}
+
+void NepaliRomanEngine::applySourceWeights() {
+    for (const auto &source : sources_->sources()) {
+        const auto &name = source->name();
+        if (name == kSourceSystem) {
+            source->setWeight(percent(config_.systemDictionaryWeight.value()));
+        } else if (name == kSourceUser) {
+            source->setWeight(percent(config_.userDictionaryWeight.value()));
+        } else {
+            source->setWeight(percent(config_.domainDictionaryWeight.value()));
+        }
+    }
+}
+
+void NepaliRomanEngine::loadSnippets() {
+    auto path = lekhikaDataPath(kSnippetFile);
+    struct stat st;
+    int64_t mtime = ::stat(path.c_str(), &st) == 0
+                        ? static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                              st.st_mtim.tv_nsec
+                        : 0;
+    if (mtime == snippetsMtime_) {
+        return;
+    }
+    snippetsMtime_ = mtime;
+    if (mtime == 0) {
+        snippets_.clear();
+    } else {
+        snippets_.load(path);
+    }
+}
+
+std::vector<std::string>
+NepaliRomanEngine::snippetCandidates(const std::string &buffer) {
+    std::vector<std::string> texts;
+    if (!enableSnippets_) {
+        return texts;
+    }
+    for (const auto &match : snippets_.matchSuffixes(buffer)) {
+        if (match.start == 0) {
+            texts.push_back(*match.expansion);
+        } else if (buffer.size() - match.start >= kMinSnippetSuffix) {
+            // The text before the trigger is still transliterated
+            texts.push_back(
+                transliterate(buffer.substr(0, match.start)) +
+                *match.expansion);
+        }
+    }
+    return texts;
+}
+
+EnglishWordModel::Score
+NepaliRomanEngine::englishScore(const std::string &buffer) const {
+    // Capitals are transliteration notation (T, D, N, Sh), not English
+    if (!detectEnglishWords_ || buffer.size() < kMinEnglishLength ||
+        !std::all_of(buffer.begin(), buffer.end(),
+                     [](unsigned char c) { return c >= 'a' && c <= 'z'; })) {
+        return EnglishWordModel::Unknown;
+    }
+    return english_.score(buffer);
+}
+
+std::string NepaliRomanEngine::topCompletion(const std::string &prefix) {
+    // Picks boosted for this prefix can change which word is best, so it
+    // only reuses what was looked up for itself
+    if (const std::string *cached =
+            completions_.find(prefix, !boosts_.boosted(prefix))) {
+        return *cached;
+    }
+    // A few extra in case the best is the prefix itself or a broken row
+    std::string best;
+    bool complete = true;
+    auto words = lookupSuggestions(prefix, 4, lookupDeadline(), &complete);
+    bool noWords = words.empty();
+    for (auto &word : words) {
+        if (word.size() > prefix.size() &&
+            word.compare(0, prefix.size(), prefix) == 0 &&
+            lekhika::validateUtf8(word) &&
+            !(lekhika::classifyScript(word) & lekhika::ScriptOther)) {
+            best = std::move(word);
+            break;
+        }
+    }
+    if (complete) {
+        completions_.store(prefix, best, noWords);
+    }
+    return best;
+}
+
+bool NepaliRomanEngine::fillSuggestions(SpeculativeEntry &entry,
+                                        uint64_t deadline) {
+    // Buffers whose previews ask the same query share one lookup
+    std::string query = dictionaryQuery(entry.preview);
+    if (const auto *shared = queries_.find(query);
+        shared && shared->hasSuggestions) {
+        entry.suggestions = shared->suggestions;
+        entry.hasSuggestions = true;
+        return true;
+    }
+    bool complete = true;
+    entry.suggestions = lookupSuggestions(query, std::max(1, suggestionLimit_),
+                                          deadline, &complete);
+    entry.hasSuggestions = complete;
+    if (complete) {
+        auto &shared = queries_.insert(query);
+        shared.suggestions = entry.suggestions;
+        shared.hasSuggestions = true;
+    }
+    return complete;
+}
+
+uint64_t NepaliRomanEngine::lookupDeadline() const {
+    return suggestionDeadlineMs_ > 0
+               ? now(CLOCK_MONOTONIC) + suggestionDeadlineMs_ * 1000ULL
+               : 0;
+}
+
+// Finishing a list runs on the main loop too, so it is done in bounded
+// steps. Keys typed in between are handled first and make the rest moot.
+void NepaliRomanEngine::schedulePreload() {
+    preloadEvent_ = instance_->eventLoop().addTimeEvent(
+        CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + kPreloadStepDelayUs, 0,
+        [this](EventSourceTime *, uint64_t) {
+            if (enableSuggestion_ && sources_->preloadNext()) {
+                schedulePreload();
+            }
+            return true;
+        });
+}
+
+void NepaliRomanEngine::scheduleRefine(InputContext *ic,
+                                       const std::string &buffer, int step) {
+    refineEvent_ = instance_->eventLoop().addTimeEvent(
+        CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + kRefineStepDelayUs, 0,
+        [this, ref = ic->watch(), buffer, step](EventSourceTime *, uint64_t) {
+            auto *ic = ref.get();
+            if (!ic) {
+                return true;
+            }
+            // Only finish the list the user is still looking at
+            auto *state = ic->propertyFor(&factory_);
+            if (state->buffer_ != buffer ||
+                state->cursorPos_ != buffer.length() ||
+                state->navigatedInCandidates_) {
+                return true;
+            }
+            auto &entry = speculative_.insert(buffer);
+            if (!entry.hasSuggestions) {
+                if (entry.preview.empty()) {
+                    entry.preview =
+                        lekhika::toNfc(transliterate(buffer));
+                }
+                // A query that never fits a budget gets a longer one each
+                // time, so it finishes in a few steps all the same
+                uint64_t budget = suggestionDeadlineMs_ * 1000ULL
+                                  << std::min(step + 1, kMaxRefineDoublings);
+                uint64_t deadline =
+                    budget ? now(CLOCK_MONOTONIC) + budget : 0;
+                if (!fillSuggestions(entry, deadline)) {
+                    scheduleRefine(ic, buffer, step + 1);
+                    return true;
+                }
+            }
+            updateCandidates(ic, buffer);
+            ic->updateUserInterface(UserInterfaceComponent::InputPanel);
+            return true;
+        });
+}
+
+std::vector<std::string>
+NepaliRomanEngine::lookupSuggestions(const std::string &prefix, int limit,
+                                     uint64_t deadline, bool *complete) {
+    auto size = static_cast<size_t>(std::max(1, limit));
+    auto contains = [](const std::vector<ScoredWord> &list,
+                       const std::string &word) {
+        return std::any_of(
+            list.begin(), list.end(),
+            [&word](const ScoredWord &w) { return w.word == word; });
+    };
+
+    // Words the user keeps using are the first tier; when they fill the
+    // list no dictionary can displace them and none is asked
+    auto recent = recent_.find(prefix, size);
+    std::vector<ScoredWord> seed;
+    for (const auto &match : recent) {
+        if (match.score >= kConfidentRecentScore) {
+            seed.push_back({match.word, kRecentTierScore + match.score});
+        }
+    }
+    std::function<bool()> expired;
+    if (deadline) {
+        expired = [deadline]() { return now(CLOCK_MONOTONIC) >= deadline; };
+    }
+    bool finished = true;
+#ifdef HAVE_SQLITE3
+    learnedLookupCut_ = false;
+    if (store_) {
+        store_->setInterrupt(expired);
+    }
+#endif
+    auto scored =
+        sources_->lookup(prefix, size, std::move(seed), expired, &finished);
+#ifdef HAVE_SQLITE3
+    if (store_) {
+        store_->setInterrupt({});
+    }
+    if (learnedLookupCut_) {
+        // The learned-word source cached the partial answer; drop it
+        finished = false;
+        if (auto *source = sources_->source(kSourceUser)) {
+            source->invalidate();
+        }
+    }
+#endif
+    if (complete) {
+        *complete = finished;
+    }
+    double floor = scored.empty() ? 0 : scored.back().score;
+    for (const auto &match : recent) {
+        if (scored.size() >= size) {
+            break;
+        }
+        if (!contains(scored, match.word)) {
+            scored.push_back({match.word, floor});
+        }
+    }
+    boosts_.apply(prefix, scored, size);
+    std::vector<std::string> words;
+    for (auto &word : scored) {
+        words.push_back(std::move(word.word));
+    }
+    return words;
+}
+
+CandidatePick NepaliRomanEngine::recordSelection(const std::string &prefix,
+                                                 const std::string &word,
+                                                 int rank) {
+    CandidatePick pick;
+    if (prefix.empty() || word.empty()) {
+        return pick;
+    }
+    pick.prefix = dictionaryQuery(prefix);
+    pick.word = lekhika::toNfc(word);
+    // Passing over better-ranked words says more than taking the first
+    pick.boost = rank > 0 ? 2 : 1;
+#ifdef HAVE_SQLITE3
+    // Only single Nepali words are learned, as when typed
+    pick.learn = dictionary_ && enableDictionaryLearning_ &&
+                 lekhika::classifyScript(pick.word) == lekhika::ScriptDevanagari;
+#endif
+    // Writing to the store can wait until the key has been handled
+    if (pendingSelections_.empty()) {
+        feedbackEvent_ = instance_->eventLoop().addDeferEvent(
+            [this](EventSource *) {
+                processSelections();
+                return true;
+            });
+    }
+    pendingSelections_.push_back(pick);
+    return pick;
+}
+
+void NepaliRomanEngine::processSelections() {
+    auto selections = std::move(pendingSelections_);
+    pendingSelections_.clear();
+    for (const auto &selection : selections) {
+        boosts_.add(selection.prefix, selection.word, selection.boost);
+        rememberRecent(selection.word);
+#ifdef HAVE_SQLITE3
+        if (store_) {
+            store_->addSelection(selection.prefix, selection.word,
+                                 selection.boost);
+        }
+        if (selection.learn) {
+            learnWord(selection.word);
+        }
+#endif
+    }
+    speculative_.clearSuggestions();
+    queries_.clear();
+    completions_.clear();
+}
+
+void NepaliRomanEngine::rememberRecent(const std::string &word) {
+    if (lekhika::classifyScript(word) != lekhika::ScriptDevanagari ||
+        word.find(' ') != std::string::npos) {
+        return;
+    }
+    recent_.touch(lekhika::toNfc(word));
+    speculative_.clearSuggestions();
+    queries_.clear();
+    completions_.clear();
+    // Save once typing pauses rather than on every word
+    recentSaveEvent_ = instance_->eventLoop().addTimeEvent(
+        CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + kRecentSaveDelayUs, 0,
+        [this](EventSourceTime *, uint64_t) {
+            if (recent_.dirty()) {
+                recent_.save(lekhikaDataPath(kRecentFile));
+            }
+            return true;
+        });
+}
+
+#ifdef HAVE_SQLITE3
+  //=============================================================================//
+ // Dictionary Snapshot                                                         //
+//=============================================================================//
+
+// Picks up generations published by another instance, and rebuilds the
+// snapshot once lekhika-trainer or lekhika-cli changed the database
+void NepaliRomanEngine::checkLearnedWords() {
+    auto current = now(CLOCK_MONOTONIC);
+    if (current - snapshotCheckedAt_ < kSnapshotCheckIntervalUs) {
+        return;
+    }
+    snapshotCheckedAt_ = current;
+    if (snapshot_.refresh()) {
+        invalidateLearnedWords();
+    }
+    if (!snapshotDirty_ && snapshot_.source() != dictionaryStamp()) {
+        snapshotDirty_ = true;
+        reindexLearned_ = true;
+        invalidateLearnedWords();
+        scheduleSnapshotPublish(kSnapshotPublishDelayUs);
+    }
+}
+
+// Bound for the learned-word tier, so it is skipped like the word lists
+// once it cannot change the list. Worked out once per head from wherever
+// lookupLearnedWords reads, and kept until the learned words change.
+uint64_t NepaliRomanEngine::learnedMaxFrequency(const std::string &prefix) {
+    checkLearnedWords();
+    if (prefix.empty()) {
+        return UINT64_MAX;
+    }
+    // Longer prefixes share the bound of their first two characters
+    std::string head = prefix.substr(0, lekhika::codePointPrefix(prefix, 2));
+    auto it = learnedHeadMax_.find(head);
+    if (it != learnedHeadMax_.end()) {
+        return it->second;
+    }
+    uint64_t bound = UINT64_MAX;
+    if (snapshot_.isOpen() && !snapshotDirty_) {
+        auto top = snapshot_.findPrefix(head, 1);
+        bound = top.empty() ? 0 : top.front().weight;
+    } else if (store_ && store_->indexed() && !reindexLearned_) {
+        auto top = store_->findPrefix(head, 1);
+        if (store_->interrupted()) {
+            return UINT64_MAX;
+        }
+        bound = top.empty() ? 0
+                            : static_cast<uint64_t>(
+                                  std::max<int64_t>(top.front().frequency, 0));
+    }
+    // DictionaryManager alone ranks without frequencies: no bound
+    learnedHeadMax_.emplace(std::move(head), bound);
+    return bound;
+}
+
+SuggestionSource::RawWords
+NepaliRomanEngine::lookupLearnedWords(const std::string &prefix, size_t limit) {
+    checkLearnedWords();
+
+    SuggestionSource::RawWords words;
+    if (snapshot_.isOpen() && !snapshotDirty_) {
+        for (const auto &match : snapshot_.findPrefix(prefix, limit)) {
+            words.emplace_back(std::string(match.key), match.weight);
+        }
+        return words;
+    }
+
+    // Words learned since the last publish are only in the database
+    if (store_) {
+        for (auto &word : store_->findPrefix(prefix, static_cast<int>(limit))) {
+            words.emplace_back(std::move(word.text),
+                               static_cast<uint64_t>(std::max<int64_t>(
+                                   word.frequency, 0)));
+        }
+        learnedLookupCut_ = learnedLookupCut_ || store_->interrupted();
+        return words;
+    }
+    // DictionaryManager only ranks; turn the rank into a frequency
+    auto ranked = dictionary_->findWords(prefix, static_cast<int>(limit));
+    uint64_t frequency = ranked.size();
+    for (auto &word : ranked) {
+        words.emplace_back(std::move(word), frequency--);
+    }
+    return words;
+}
+
+void NepaliRomanEngine::learnWord(const std::string &word, int64_t increment) {
+    std::string text = lekhika::toNfc(word);
+    if (store_) {
+        if (!store_->addWord(text, increment)) {
+            reindexLearned_ = true;
+        }
+    } else if (increment > 0) {
+        dictionary_->addWord(text);
+    } else {
+        return; // liblekhika cannot forget a word
+    }
+    invalidateLearnedWords();
+    snapshotDirty_ = true;
+    // A publish already running may have read the table before this word
+    publishAgain_ = publishThread_.joinable();
+    scheduleSnapshotPublish(kSnapshotPublishDelayUs);
+}
+
+void NepaliRomanEngine::invalidateLearnedWords() {
+    learnedHeadMax_.clear();
+    speculative_.clearSuggestions();
+    queries_.clear();
+    completions_.clear();
+    // Learned words are shared by every language
+    if (auto *source = nepaliSources_.source(kSourceUser)) {
+        source->invalidate();
+    }
+    for (const auto &[name, variant] : variants_) {
+        if (auto *source = variant->sources.source(kSourceUser)) {
+            source->invalidate();
+        }
+    }
+}
+
+void NepaliRomanEngine::scheduleSnapshotPublish(uint64_t delayUs) {
+    // Coalesce bursts of learning into one publish
+    publishEvent_ = instance_->eventLoop().addTimeEvent(
+        CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + delayUs, 0,
+        [this](EventSourceTime *, uint64_t) {
+            publishDictionarySnapshot();
+            return true;
+        });
+}
+
+void NepaliRomanEngine::publishDictionarySnapshot() {
+    if (publishThread_.joinable()) {
+        // One publish at a time; whatever it missed goes into the next
+        publishAgain_ = true;
+        return;
+    }
+    publishAgain_ = false;
+    // Taken before reading, so a write that races the publish is seen as
+    // a change on the next check
+    uint64_t source = dictionaryStamp();
+    std::vector<SnapshotEntry> entries;
+    if (!store_) {
+        // liblekhika is only ever called from this thread: its words are
+        // read here and only sorted and written on the publish thread.
+        // findWords returns the most frequent words first; their rank
+        // stands in for the frequency in the snapshot.
+        auto words = dictionary_->findWords("", kSnapshotMaxWords);
+        entries.reserve(words.size());
+        auto weight = static_cast<uint32_t>(words.size());
+        for (auto &word : words) {
+            if (lekhika::validateUtf8(word)) {
+                entries.push_back(
+                    {lekhika::toNfc(std::move(word)), {}, weight});
+            }
+            --weight;
+        }
+    }
+
+    // Reading the whole table, sorting and syncing the file takes far
+    // longer than a key may, so none of it runs on the event loop
+    bool fromStore = store_ != nullptr;
+    bool reindex = fromStore && reindexLearned_;
+    reindexLearned_ = false;
+    auto dictionaryPath = lekhikaDataPath(kDictionaryFile);
+    auto storePath = lekhikaDataPath(kStoreFile);
+    auto path = lekhikaDataPath(kSnapshotFile);
+    publishThread_ = std::thread([this, source, fromStore, reindex,
+                                  dictionaryPath, storePath, path,
+                                  entries = std::move(entries)]() mutable {
+        bool read = true;
+        bool reindexed = false;
+        if (fromStore) {
+            // The engine's connection belongs to the event loop's thread
+            WordStore store;
+            read = store.open(dictionaryPath, storePath);
+            if (read) {
+                // Words other programs wrote reach the prefix index here
+                reindexed = reindex && store.reindex();
+                entries = snapshotEntries(store.topWords(kSnapshotMaxWords));
+            }
+        }
+        bool published =
+            read && publishSnapshot(path, std::move(entries), source);
+        bool reindexFailed = reindex && !reindexed;
+        publishDispatcher_.schedule([this, published, reindexFailed]() {
+            finishSnapshotPublish(published, reindexFailed);
+        });
+    });
+}
+
+void NepaliRomanEngine::finishSnapshotPublish(bool published,
+                                              bool reindexFailed) {
+    publishThread_.join();
+    if (reindexFailed) {
+        reindexLearned_ = true;
+    }
+    auto path = lekhikaDataPath(kSnapshotFile);
+    if (!published) {
+        FCITX_WARN() << "Lekhika: could not publish suggestion snapshot "
+                     << path;
+    } else {
+        if (!snapshot_.refresh() && !snapshot_.isOpen()) {
+            snapshot_.open(path);
+        }
+        // Words learned while it ran may be missing; the database answers
+        // for them until the next publish
+        snapshotDirty_ = publishAgain_;
+        invalidateLearnedWords();
+    }
+    if (publishAgain_) {
+        scheduleSnapshotPublish(kSnapshotPublishDelayUs);
+    }
+}
+#endif
+
   //=============================================================================//
  // Factory Registration                                                        //
 //=============================================================================//
@@ -7,26 +7,51 @@
 #include <fcitx/inputmethodengine.h>
 #include <fcitx/instance.h>
 #include <fcitx/action.h>
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/eventdispatcher.h>
 
 #include <liblekhika/lekhika_core.h> //liblekhika include
 
+#include "lekhika-english.h"
+#include "lekhika-lattice.h"
+#include "lekhika-layout.h"
+#include "lekhika-prefetch.h"
+#include "lekhika-recent.h"
+#include "lekhika-snapshot.h"
+#include "lekhika-snippets.h"
+#include "lekhika-sources.h"
+#include "lekhika-symbols.h"
+#include "lekhika-variants.h"
+#include "lekhika-watchdog.h"
+#ifdef HAVE_SQLITE3
+#include "lekhika-store.h"
+#endif
+
+#include <algorithm>
+#include <array>
 #include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 using namespace fcitx;
 
-#ifdef HAVE_SQLITE3
+class NepaliRomanEngine;
+
 /* ----------  concrete candidate-word object  ---------- */
+// Selecting with the mouse goes through the engine, so it commits exactly
+// like a number key: buffer reset, separating space and undo history.
 class LekhikaCandidateWord : public CandidateWord {
 public:
-    explicit LekhikaCandidateWord(Text t)
-        : CandidateWord(std::move(t)) {}
+    LekhikaCandidateWord(Text t, NepaliRomanEngine *engine)
+        : CandidateWord(std::move(t)), engine_(engine) {}
 
-    void select(InputContext *ic) const override {
-        ic->commitString(text().toString());
-    }
+    void select(InputContext *ic) const override;
+
+private:
+    NepaliRomanEngine *engine_;
 };
 
 /* ----------  custom candidate-list  ---------- */
@@ -56,7 +81,6 @@ private:
     Text empty_;
     bool horizontal_ = false;
 };
-#endif // HAVE_SQLITE3
 
 /* ----------  configuration  ---------- */
 FCITX_CONFIGURATION(
@@ -69,21 +93,138 @@ FCITX_CONFIGURATION(
     Option<bool> enableDictionaryLearning{this, "EnableDictionaryLearning", "Enable Dictionary Learning", false};
     Option<bool> horizontalLayout{this, "HorizontalLayout", "Display candidates horizontally", false};
     Option<int> suggestionLimit{this, "SuggestionLimit", "Maximum number of suggestions", 7};
+    Option<int> systemDictionaryWeight{this, "SystemDictionaryWeight", "System Word List Weight (%)", 100};
+    Option<int> userDictionaryWeight{this, "UserDictionaryWeight", "Learned Words Weight (%)", 150};
+    Option<int> domainDictionaryWeight{this, "DomainDictionaryWeight", "Domain Word Lists Weight (%)", 80};
+    Option<bool> enableSnippets{this, "EnableSnippets", "Enable Snippets", true};
+    Option<bool> expandSnippetsOnCommit{this, "ExpandSnippetsOnCommit", "Expand Snippets on Commit", false};
+    Option<bool> enableSymbolPicker{this, "EnableSymbolPicker", "Enable Symbol Picker (type :)", true};
+    Option<bool> detectEnglishWords{this, "DetectEnglishWords", "Offer English Words Untransliterated", true};
+    Option<bool> showInlineCompletion{this, "ShowInlineCompletion", "Show Top Suggestion Inline (Tab accepts)", true};
+    Option<bool> offerSpellingVariants{this, "OfferSpellingVariants", "Offer Spelling Variants When No Word Matches", true};
+    Option<bool> sentenceMode{this, "SentenceMode", "Compose Whole Sentences (Space keeps composing, Enter commits)", false};
+    Option<bool> layoutSuggestions{this, "LayoutSuggestions", "Suggest Words in the Nepali Keyboard Layouts (Tab accepts)", true};
     Option<bool> spacecanCommitSuggestions{this, "UseSpacetoCommitSuggestions", "Use Space to Commit Suggestions", false};
+    KeyListOption convertSelectionKey{this, "ConvertSelectionKey", "Transliterate Selected Text", {Key("Control+Alt+T")}, KeyListConstrain()};
+    KeyListOption romanizeSelectionKey{this, "RomanizeSelectionKey", "Romanize Selected Devanagari Text", {Key("Control+Alt+R")}, KeyListConstrain()};
+    KeyListOption undoCommitKey{this, "UndoCommitKey", "Undo Last Commit", {Key("Control+Alt+Z")}, KeyListConstrain()};
+    Option<int> suggestionDeadlineMs{this, "SuggestionDeadlineMs", "Suggestion Time Budget per Key (ms, 0 disables)", 8};
+    Option<int> maxComposingLength{this, "MaxComposingLength", "Commit Settled Text Past This Many Letters (0 disables)", 32};
+    Option<int> keyLatencyBudgetMs{this, "KeyLatencyBudgetMs", "Pause Suggestions When Keys Take Longer Than (ms, 0 disables)", 30};
+    Option<int> speculativePrefetchKeys{this, "SpeculativePrefetchKeys", "Likely next keys to prepare while idle (0 disables)", 3};
+    );
+
+// Settings of the Hindi, Marathi and Sanskrit input methods; the rest is
+// shared with Nepali. liblekhika's corrections are written for Nepali, so
+// they start out off.
+FCITX_CONFIGURATION(
+    LanguageVariantConfig,
+    Option<bool> enableSuggestion{this, "EnableSuggestions", "Enable Suggestions", true};
+    Option<bool> enableSmartCorrection{this, "EnableSmartCorrection", "Enable Smart Correction", false};
+    Option<bool> enableAutoCorrect{this, "EnableAutoCorrect", "Enable Auto-Correction", false};
+    Option<bool> enableIndicNumbers{this, "EnableIndicNumbers", "Enable Indic Numbers", true};
     );
 
+/* ----------  one language served by the engine  ---------- */
+// Created when its input method is first configured or used. The rewrite
+// table is only read once the input method is used; the liblekhika mapping
+// and everything else stay shared with Nepali.
+struct LanguageVariant {
+    std::string uniqueName;
+    std::string code; // "hi", "mr", "sa"
+    LanguageVariantConfig config;
+    OutputRewrites rewrites;
+    bool rewritesLoaded = false;
+    // The language's own word lists, set up when it is first used
+    SuggestionFederation sources;
+    bool sourcesReady = false;
+};
+
+/* ----------  a candidate picked from the list  ---------- */
+// Fed back into ranking once the key is handled, and taken back by undo
+struct CandidatePick {
+    std::string prefix; // dictionary query the list was shown for
+    std::string word;
+    int64_t boost = 0;  // added to the word's count for prefix; 0 if none
+    bool learn = false; // the word is also learned
+};
+
+/* ----------  recent commits, for undo  ---------- */
+// Also used for the finished words of a sentence still being composed
+struct CommitRecord {
+    std::string buffer;                  // Roman text that was composed
+    std::string output;                  // text sent to the application
+    std::vector<std::string> candidates; // list shown when it was committed
+    int candidateCursor = -1;
+    bool learned = false;                // output was added to the store
+    CandidatePick pick;                  // how output was picked, if it was
+};
+
+// Fixed-size ring; the oldest record is overwritten once it is full.
+class CommitHistory {
+public:
+    static constexpr size_t kCapacity = 8;
+
+    bool empty() const { return size_ == 0; }
+    void clear() { size_ = 0; }
+    void push(CommitRecord record) {
+        records_[next_] = std::move(record);
+        next_ = (next_ + 1) % kCapacity;
+        size_ = std::min(size_ + 1, kCapacity);
+    }
+    CommitRecord pop() {
+        next_ = (next_ + kCapacity - 1) % kCapacity;
+        --size_;
+        return std::move(records_[next_]);
+    }
+
+private:
+    std::array<CommitRecord, kCapacity> records_;
+    size_t next_ = 0;
+    size_t size_ = 0;
+};
+
+/* ----------  Roman to output alignment, for segment editing  ---------- */
+// Where the output of the Roman text before a position ends in the output
+// of the whole buffer. Filled lazily, one entry per position asked for.
+struct SegmentAlignment {
+    std::string buffer;
+    std::string output;
+    std::vector<std::pair<size_t, size_t>> offsets; // Roman -> output bytes
+};
+
+// One alternative for the segment under the cursor
+struct SegmentEdit {
+    std::string buffer; // Roman text with the segment respelled
+    std::string output; // its transliteration, patched in place
+    size_t cursor;      // end of the respelled segment
+};
+
 /* ----------  per-input-context state  ---------- */
 class NepaliRomanState : public InputContextProperty {
 public:
     std::string buffer_;
     size_t cursorPos_ = 0;
     bool navigatedInCandidates_ = false;
+    CommitHistory history_;
+    SegmentAlignment alignment_;
+    // Non-empty while the candidates are alternatives for one segment
+    std::vector<SegmentEdit> segmentEdits_;
+    // Word shown inline after the preedit, empty if none
+    std::string completion_;
+    // Devanagari of the current word typed with a keyboard layout
+    std::string layoutWord_;
+    // Finished words before buffer_ while composing a sentence
+    std::vector<CommitRecord> sentence_;
+    // Slow key handling here pauses suggestions, learning and prefetch
+    LatencyWatchdog watchdog_;
 };
 
 /* ----------  main engine  ---------- */
 class NepaliRomanEngine : public InputMethodEngine {
 public:
     explicit NepaliRomanEngine(Instance *instance);
+    ~NepaliRomanEngine() override;
 
     const Configuration *getConfig() const override;
     Configuration *getMutableConfig();
@@ -93,28 +234,157 @@ public:
     void keyEvent(const InputMethodEntry &, KeyEvent &keyEvent) override;
     void reset(const InputMethodEntry &entry, InputContextEvent &event) override;
     void reloadConfig() override;
+    const Configuration *
+    getConfigForInputMethod(const InputMethodEntry &entry) const override;
+    void setConfigForInputMethod(const InputMethodEntry &entry,
+                                 const RawConfig &config) override;
+
+    // Called by LekhikaCandidateWord when a candidate is clicked
+    void selectCandidate(InputContext *ic, const CandidateWord *word);
 
 private:
     // Non-virtual helpers
     void applyConfig();
     void ensureConfigExists();
-    void updatePreedit(InputContext *ic);
+    void handleKey(NepaliRomanState *state, KeyEvent &keyEvent);
+    const KeyboardLayout *layoutFor(const InputMethodEntry &entry);
+    void handleLayoutKey(const KeyboardLayout &layout, NepaliRomanState *state,
+                         KeyEvent &keyEvent);
+    void updateLayoutCandidates(NepaliRomanState *state, InputContext *ic);
+    void commitLayoutCandidate(NepaliRomanState *state, InputContext *ic,
+                               int index);
+    void endLayoutWord(NepaliRomanState *state, InputContext *ic);
+    void watchLatency(NepaliRomanState *state, InputContext *ic,
+                      uint64_t latencyUs);
+    void updatePreedit(InputContext *ic, bool refreshCandidates = true);
     void updateCandidates(InputContext *ic, const std::string &prefix);
+    bool updateSegmentCandidates(NepaliRomanState *state, InputContext *ic);
+    size_t alignedOffset(NepaliRomanState *state, size_t romanPos);
+    void applySegmentEdit(NepaliRomanState *state, InputContext *ic, int index);
     void commitBuffer(NepaliRomanState *state, InputContext *ic);
+    void commitCandidate(NepaliRomanState *state, InputContext *ic, int index);
     void commitRawBuffer(NepaliRomanState *state, InputContext *ic);
+    std::string finishBuffer(NepaliRomanState *state, bool *learned);
+    void appendSentenceWord(NepaliRomanState *state, InputContext *ic,
+                            std::string output, bool learned,
+                            CandidatePick pick = {});
+    void editSentenceWord(NepaliRomanState *state, InputContext *ic);
+    void showCandidates(InputContext *ic, std::vector<std::string> candidates,
+                        int cursor);
+    void commitStablePrefix(NepaliRomanState *state, InputContext *ic);
+    bool acceptCompletion(NepaliRomanState *state, InputContext *ic);
+    std::string topCompletion(const std::string &prefix);
     void resetState(NepaliRomanState *state, InputContext *ic);
+    void recordCommit(NepaliRomanState *state, InputContext *ic,
+                      std::string output, bool learned,
+                      CandidatePick pick = {});
+    bool undoCommit(NepaliRomanState *state, InputContext *ic);
+    void forgetCommit(const CommitRecord &record);
+    std::string transliterate(const std::string &roman);
+    std::string transliterateBuffer(const std::string &buffer);
+    std::string transliterateText(const std::string &text);
+    bool convertSelection(InputContext *ic, bool romanize);
+    void schedulePrefetch(const std::string &buffer);
+    void prefetch(const std::string &buffer);
+    LanguageVariant *variantFor(const InputMethodEntry &entry) const;
+    void selectVariant(const InputMethodEntry &entry);
+    void setupSuggestionSources();
+    void loadSnippets();
+    std::vector<std::string> snippetCandidates(const std::string &buffer);
+    EnglishWordModel::Score englishScore(const std::string &buffer) const;
+    void applySourceWeights();
+    std::vector<std::string> lookupSuggestions(const std::string &prefix,
+                                               int limit, uint64_t deadline = 0,
+                                               bool *complete = nullptr);
+    bool fillSuggestions(SpeculativeEntry &entry, uint64_t deadline = 0);
+    uint64_t lookupDeadline() const;
+    void scheduleRefine(InputContext *ic, const std::string &buffer,
+                        int step = 0);
+    void schedulePreload();
+    CandidatePick recordSelection(const std::string &prefix,
+                                  const std::string &word, int rank);
+    void rememberRecent(const std::string &word);
+    void processSelections();
+#ifdef HAVE_SQLITE3
+    void checkLearnedWords();
+    SuggestionSource::RawWords lookupLearnedWords(const std::string &prefix,
+                                                  size_t limit);
+    uint64_t learnedMaxFrequency(const std::string &prefix);
+    void learnWord(const std::string &word, int64_t increment = 1);
+    void invalidateLearnedWords();
+    void scheduleSnapshotPublish(uint64_t delayUs);
+    void publishDictionarySnapshot();
+    void finishSnapshotPublish(bool published, bool reindexed);
+#endif
 
     Instance *instance_;
     FactoryFor<NepaliRomanState> factory_;
     std::unique_ptr<Transliteration> transliterator_;
 
+    // Input methods other than Nepali, by unique name; the active one is
+    // variant_, or nullptr for Nepali
+    mutable std::unordered_map<std::string, std::unique_ptr<LanguageVariant>>
+        variants_;
+    LanguageVariant *variant_ = nullptr;
+
+    // Direct keyboard layouts by input method, loaded on first use
+    std::unordered_map<std::string, std::unique_ptr<KeyboardLayout>> layouts_;
+    bool layoutSuggestions_ = true;
+
 #ifdef HAVE_SQLITE3
     std::unique_ptr<DictionaryManager> dictionary_;
-    bool enableSuggestion_ = false;
+    std::unique_ptr<WordStore> store_; // preferred over dictionary_ when open
     bool enableDictionaryLearning_ = false;
+
+    // Compiled suggestion index shared with other lekhika processes
+    SnapshotReader snapshot_;
+    bool snapshotDirty_ = false;
+    bool reindexLearned_ = false; // store's prefix index may miss words
+    uint64_t snapshotCheckedAt_ = 0;
+    std::unique_ptr<EventSourceTime> publishEvent_;
+    // Publishes are built on a thread of their own and handed back to the
+    // event loop through the dispatcher
+    std::thread publishThread_;
+    EventDispatcher publishDispatcher_;
+    bool publishAgain_ = false; // learned more while a publish was running
+    bool learnedLookupCut_ = false; // last store query hit the deadline
+    // Highest learned frequency by first two characters
+    std::unordered_map<std::string, uint64_t> learnedHeadMax_;
+#endif
+
+    // System, learned and domain word lists merged for suggestions; sources_
+    // points at the active language's set
+    SuggestionFederation nepaliSources_;
+    SuggestionFederation *sources_ = &nepaliSources_;
+    bool enableSuggestion_ = false;
     int suggestionLimit_ = 7;
     bool horizontalLayout_ = false;
-#endif
+    // Lookups stop at this budget; the rest is finished after the key
+    int suggestionDeadlineMs_ = 8;
+    std::unique_ptr<EventSource> refineEvent_;
+    std::unique_ptr<EventSource> preloadEvent_;
+    // p95 key latency above which a context drops its optional work
+    int keyLatencyBudgetMs_ = 30;
+    // Longer buffers have their settled head committed while typing
+    int maxComposingLength_ = 32;
+
+    // Roman trigger -> text expansions from the user's snippet file
+    SnippetTable snippets_;
+    int64_t snippetsMtime_ = -1;
+    bool enableSnippets_ = true;
+    bool expandSnippetsOnCommit_ = false;
+
+    // Symbol and emoji search started with ':'
+    std::unique_ptr<SymbolIndex> symbols_;
+    bool enableSymbolPicker_ = true;
+
+    // Mixed-script typing: English words typed in Roman stay as they are
+    EnglishWordModel english_;
+    bool detectEnglishWords_ = true;
+
+    // Respellings offered when the dictionary knows no word for the buffer
+    VariantLattice lattice_;
+    bool offerSpellingVariants_ = true;
 
     NepaliRomanEngineConfig config_;
     bool enableSmartCorrection_ = true;
@@ -122,6 +392,31 @@ private:
     bool enableIndicNumbers_ = true;
     bool enableSymbolsTransliteration_ = true;
     bool spacecanCommitSuggestions_ = false;
+    bool sentenceMode_ = false;
+    KeyList convertSelectionKey_;
+    KeyList romanizeSelectionKey_;
+    KeyList undoCommitKey_;
+
+    // Speculative work done between keystrokes
+    RomanKeyModel keyModel_;
+    SpeculativeCache speculative_;
+    // Suggestions by dictionary query, shared by buffers that ask the same
+    SpeculativeCache queries_{64};
+    std::unique_ptr<EventSource> prefetchEvent_;
+    int speculativePrefetchKeys_ = 3;
+
+    // Recently committed words, consulted before any dictionary
+    RecentWords recent_;
+    std::unique_ptr<EventSourceTime> recentSaveEvent_;
+
+    // Candidate picks, fed back into ranking once the key is handled
+    SelectionBoosts boosts_;
+    std::vector<CandidatePick> pendingSelections_;
+    std::unique_ptr<EventSource> feedbackEvent_;
+
+    // Top suggestion shown inline after the preedit
+    CompletionCache completions_;
+    bool showInlineCompletion_ = true;
 };
 
 #endif // LEKHIKA_ADDON_H
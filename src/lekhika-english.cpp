@@ -0,0 +1,109 @@
+// lekhika-english.cpp
+
+#include "lekhika-english.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+
+namespace {
+
+// Ranks below these limits land in VeryCommon and Common; the rest is Known
+constexpr size_t kVeryCommonRank = 150;
+constexpr size_t kCommonRank = 400;
+// 16 bits per word and 11 probes keep false positives near 0.05% per
+// band; a false hit would hide Nepali suggestions, so memory is cheaper
+constexpr size_t kBitsPerWord = 16;
+constexpr int kProbes = 11;
+
+uint64_t hashWord(const std::string &word) {
+    // FNV-1a over the lowercased word, then a final avalanche so the two
+    // halves used for double hashing are independent enough
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : word) {
+        hash ^= static_cast<unsigned char>(std::tolower(c));
+        hash *= 0x100000001b3ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+} // namespace
+
+void EnglishWordModel::BloomFilter::reset(size_t expected) {
+    size_ = std::max<size_t>(64, expected * kBitsPerWord);
+    bits_.assign((size_ + 63) / 64, 0);
+}
+
+void EnglishWordModel::BloomFilter::insert(uint64_t hash) {
+    uint64_t step = (hash >> 32) | 1;
+    for (int i = 0; i < kProbes; ++i, hash += step) {
+        size_t bit = hash % size_;
+        bits_[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+}
+
+bool EnglishWordModel::BloomFilter::contains(uint64_t hash) const {
+    if (bits_.empty()) {
+        return false;
+    }
+    uint64_t step = (hash >> 32) | 1;
+    for (int i = 0; i < kProbes; ++i, hash += step) {
+        size_t bit = hash % size_;
+        if (!(bits_[bit / 64] & (uint64_t(1) << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool EnglishWordModel::load(const std::string &path) {
+    words_ = 0;
+    std::ifstream in(path);
+    if (!in) {
+        for (auto &band : bands_) {
+            band.reset(0);
+        }
+        return false;
+    }
+    std::vector<std::string> words;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line[0] != '#') {
+            words.push_back(line.substr(0, line.find_first_of("\t ")));
+        }
+    }
+
+    auto bandOf = [](size_t rank) {
+        return rank < kVeryCommonRank ? 2 : rank < kCommonRank ? 1 : 0;
+    };
+    std::array<size_t, 3> counts{};
+    for (size_t rank = 0; rank < words.size(); ++rank) {
+        ++counts[bandOf(rank)];
+    }
+    for (size_t i = 0; i < bands_.size(); ++i) {
+        bands_[i].reset(counts[i]);
+    }
+    for (size_t rank = 0; rank < words.size(); ++rank) {
+        bands_[bandOf(rank)].insert(hashWord(words[rank]));
+    }
+    words_ = words.size();
+    return true;
+}
+
+EnglishWordModel::Score EnglishWordModel::score(const std::string &word) const {
+    if (word.empty() || empty()) {
+        return Unknown;
+    }
+    uint64_t hash = hashWord(word);
+    // Most common band first: a false hit there would only inflate the score
+    // of a word that is in the list anyway
+    for (int band = static_cast<int>(bands_.size()) - 1; band >= 0; --band) {
+        if (bands_[band].contains(hash)) {
+            return static_cast<Score>(band + 1);
+        }
+    }
+    return Unknown;
+}
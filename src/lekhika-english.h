@@ -0,0 +1,46 @@
+#ifndef LEKHIKA_ENGLISH_H
+#define LEKHIKA_ENGLISH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* ----------  English word detection for mixed-script typing  ---------- */
+// Answers "is this Roman buffer an English word, and how common is it?"
+// without keeping the words themselves. The bundled list is ranked by
+// frequency and split into bands; each band is a Bloom filter, so the whole
+// model is a few kilobytes and a lookup is a handful of bit probes.
+//
+// File format: one lowercase word per line, most frequent first; lines
+// starting with '#' are comments.
+class EnglishWordModel {
+public:
+    // Bands from rare to very common; score() returns one of these
+    enum Score : int { Unknown = 0, Known = 1, Common = 2, VeryCommon = 3 };
+
+    bool load(const std::string &path);
+    bool empty() const { return words_ == 0; }
+
+    // Band of word, matched case-insensitively. A Bloom filter can report a
+    // word it never saw (rarely), never the other way round.
+    Score score(const std::string &word) const;
+
+private:
+    class BloomFilter {
+    public:
+        void reset(size_t expected);
+        void insert(uint64_t hash);
+        bool contains(uint64_t hash) const;
+
+    private:
+        std::vector<uint64_t> bits_;
+        size_t size_ = 0;
+    };
+
+    std::array<BloomFilter, 3> bands_; // Known, Common, VeryCommon
+    size_t words_ = 0;
+};
+
+#endif // LEKHIKA_ENGLISH_H
@@ -0,0 +1,198 @@
+// lekhika-lattice.cpp
+
+#include "lekhika-lattice.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <unordered_set>
+
+namespace {
+
+struct Unit {
+    const char *roman;
+    VariantLattice::Alternative alternatives[2];
+    size_t count;
+};
+
+// Longest units first, so "chh" wins over "ch" and "aa" over "a". Costs are
+// rough negative log odds of the respelling being what the user meant.
+const Unit kUnits[] = {
+    {"chh", {{"ch", 1.0f}}, 1},
+    {"ch", {{"chh", 1.0f}}, 1},
+    {"Sh", {{"sh", 0.8f}, {"s", 1.2f}}, 2},
+    {"sh", {{"s", 0.8f}, {"Sh", 1.0f}}, 2},
+    {"th", {{"Th", 0.9f}}, 1},
+    {"Th", {{"th", 0.9f}}, 1},
+    {"dh", {{"Dh", 0.9f}}, 1},
+    {"Dh", {{"dh", 0.9f}}, 1},
+    {"ai", {}, 0}, // diphthongs stay whole
+    {"au", {}, 0},
+    {"aa", {{"a", 0.7f}}, 1},
+    {"ee", {{"i", 0.6f}}, 1},
+    {"ii", {{"i", 0.6f}}, 1},
+    {"oo", {{"u", 0.6f}}, 1},
+    {"uu", {{"u", 0.6f}}, 1},
+    {"s", {{"sh", 0.8f}, {"Sh", 1.2f}}, 2},
+    {"t", {{"T", 0.9f}}, 1},
+    {"T", {{"t", 0.9f}}, 1},
+    {"d", {{"D", 0.9f}}, 1},
+    {"D", {{"d", 0.9f}}, 1},
+    {"n", {{"N", 1.1f}}, 1},
+    {"N", {{"n", 0.9f}}, 1},
+    {"a", {{"aa", 0.9f}}, 1},
+    {"i", {{"ee", 0.6f}}, 1},
+    {"u", {{"oo", 0.6f}}, 1},
+};
+constexpr size_t kMaxUnit = 3;
+// Adding or dropping the vowel after a final consonant
+constexpr float kFinalVowelCost = 0.8f;
+
+bool isConsonant(char c) {
+    return std::isalpha(static_cast<unsigned char>(c)) &&
+           !std::strchr("aeiouAEIOU", c);
+}
+
+} // namespace
+
+void VariantLattice::clear() {
+    buffer_.clear();
+    segments_.clear();
+    beams_.clear();
+}
+
+void VariantLattice::extend(const std::string &buffer) {
+    // A segment can only change if a key it may look at changed
+    size_t common = 0;
+    while (common < buffer.size() && common < buffer_.size() &&
+           buffer[common] == buffer_[common]) {
+        ++common;
+    }
+    size_t keep = 0;
+    while (keep < segments_.size() &&
+           segments_[keep].begin + kMaxUnit <= common) {
+        ++keep;
+    }
+    segments_.resize(keep);
+    beams_.resize(keep);
+    buffer_ = buffer;
+
+    size_t pos = keep ? segments_.back().begin + segments_.back().length : 0;
+    while (pos < buffer.size()) {
+        Segment segment{pos, 1, nullptr, 0};
+        for (const auto &unit : kUnits) {
+            size_t length = std::strlen(unit.roman);
+            if (buffer.compare(pos, length, unit.roman) == 0) {
+                segment = {pos, length, unit.alternatives, unit.count};
+                break;
+            }
+        }
+        pos += segment.length;
+
+        const std::vector<Hypothesis> root{{-1, 0, 0.0f}};
+        const auto &previous = beams_.empty() ? root : beams_.back();
+        std::vector<Hypothesis> next;
+        next.reserve(previous.size() * (segment.count + 1));
+        for (size_t i = 0; i < previous.size(); ++i) {
+            auto parent = beams_.empty() ? -1 : static_cast<int32_t>(i);
+            next.push_back({parent, 0, previous[i].cost});
+            for (size_t j = 0; j < segment.count; ++j) {
+                next.push_back({parent, static_cast<uint16_t>(j + 1),
+                                previous[i].cost +
+                                    segment.alternatives[j].cost});
+            }
+        }
+        // Ties break on position so a search always ranks the same way
+        auto cheaper = [](const Hypothesis &a, const Hypothesis &b) {
+            if (a.cost != b.cost) {
+                return a.cost < b.cost;
+            }
+            return a.parent != b.parent ? a.parent < b.parent
+                                        : a.alternative < b.alternative;
+        };
+        if (next.size() > beamWidth_) {
+            std::partial_sort(next.begin(), next.begin() + beamWidth_,
+                              next.end(), cheaper);
+            next.resize(beamWidth_);
+        } else {
+            std::sort(next.begin(), next.end(), cheaper);
+        }
+        segments_.push_back(segment);
+        beams_.push_back(std::move(next));
+    }
+}
+
+std::string VariantLattice::spell(const std::string &buffer,
+                                  int32_t hypothesis) const {
+    std::vector<const char *> pieces(segments_.size(), nullptr);
+    for (size_t level = segments_.size(); level-- > 0;) {
+        const auto &h = beams_[level][hypothesis];
+        if (h.alternative > 0) {
+            pieces[level] = segments_[level].alternatives[h.alternative - 1].roman;
+        }
+        hypothesis = h.parent;
+    }
+    std::string result;
+    result.reserve(buffer.size() + 4);
+    for (size_t level = 0; level < segments_.size(); ++level) {
+        if (pieces[level]) {
+            result += pieces[level];
+        } else {
+            result.append(buffer, segments_[level].begin,
+                          segments_[level].length);
+        }
+    }
+    return result;
+}
+
+const std::vector<VariantLattice::Segment> &
+VariantLattice::segment(const std::string &buffer) {
+    if (buffer.empty()) {
+        clear();
+    } else if (buffer != buffer_) {
+        extend(buffer);
+    }
+    return segments_;
+}
+
+std::vector<std::string> VariantLattice::search(const std::string &buffer,
+                                                size_t limit) {
+    std::vector<std::string> result;
+    if (buffer.empty()) {
+        clear();
+        return result;
+    }
+    extend(buffer);
+
+    std::vector<std::pair<float, std::string>> spellings;
+    const auto &beam = beams_.back();
+    for (size_t i = 0; i < beam.size(); ++i) {
+        std::string spelling = spell(buffer, static_cast<int32_t>(i));
+        size_t size = spelling.size();
+        // The inherent vowel of a final consonant: "ram" or "rama"
+        if (isConsonant(spelling[size - 1])) {
+            spellings.emplace_back(beam[i].cost + kFinalVowelCost,
+                                   spelling + 'a');
+        } else if (size >= 2 && spelling[size - 1] == 'a' &&
+                   isConsonant(spelling[size - 2])) {
+            spellings.emplace_back(beam[i].cost + kFinalVowelCost,
+                                   spelling.substr(0, size - 1));
+        }
+        spellings.emplace_back(beam[i].cost, std::move(spelling));
+    }
+    std::stable_sort(spellings.begin(), spellings.end(),
+                     [](const auto &a, const auto &b) {
+                         return a.first < b.first;
+                     });
+
+    std::unordered_set<std::string> seen{buffer};
+    for (auto &spelling : spellings) {
+        if (result.size() >= limit) {
+            break;
+        }
+        if (seen.insert(spelling.second).second) {
+            result.push_back(std::move(spelling.second));
+        }
+    }
+    return result;
+}
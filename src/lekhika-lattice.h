@@ -0,0 +1,59 @@
+#ifndef LEKHIKA_LATTICE_H
+#define LEKHIKA_LATTICE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* ----------  Roman spelling variants  ---------- */
+// Romanized Nepali is ambiguous in a few well-known places: short and long
+// vowels (i/ee, u/oo, a/aa), dental and retroflex consonants (t/T, d/D,
+// n/N), the three sibilants (s/sh/Sh), ch/chh and whether a final
+// consonant carries its inherent vowel. The buffer is cut into segments at
+// those places, each with a few alternative spellings and a cost, and a
+// bounded beam search returns the cheapest respellings of the whole buffer.
+//
+// The beam after each segment is kept, so typing one more key only extends
+// the search by the segments that changed.
+class VariantLattice {
+public:
+    struct Alternative {
+        const char *roman;
+        float cost;
+    };
+    // The text as typed is always option 0 at no cost; alternatives are
+    // the other spellings of the segment.
+    struct Segment {
+        size_t begin;
+        size_t length;
+        const Alternative *alternatives;
+        size_t count;
+    };
+
+    explicit VariantLattice(size_t beamWidth = 16) : beamWidth_(beamWidth) {}
+
+    // Up to limit respellings of buffer, cheapest first; buffer itself is
+    // never among them.
+    std::vector<std::string> search(const std::string &buffer, size_t limit);
+    // Segmentation of buffer; shares the beams with search().
+    const std::vector<Segment> &segment(const std::string &buffer);
+    void clear();
+
+private:
+    struct Hypothesis {
+        int32_t parent; // index into the previous beam, -1 at the start
+        uint16_t alternative;
+        float cost;
+    };
+
+    void extend(const std::string &buffer);
+    std::string spell(const std::string &buffer, int32_t hypothesis) const;
+
+    size_t beamWidth_;
+    std::string buffer_;
+    std::vector<Segment> segments_;
+    std::vector<std::vector<Hypothesis>> beams_; // beam after each segment
+};
+
+#endif // LEKHIKA_LATTICE_H
@@ -0,0 +1,69 @@
+// lekhika-layout.cpp
+
+#include "lekhika-layout.h"
+#include "lekhika-utf8.h"
+
+#include <cstdlib>
+#include <fstream>
+
+namespace {
+
+void appendUtf8(std::string &out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+std::string unescape(const std::string &text) {
+    std::string result;
+    result.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text.compare(i, 2, "\\u") == 0 && i + 6 <= text.size()) {
+            char *end = nullptr;
+            std::string hex = text.substr(i + 2, 4);
+            auto cp = std::strtoul(hex.c_str(), &end, 16);
+            if (end == hex.c_str() + 4) {
+                appendUtf8(result, static_cast<uint32_t>(cp));
+                i += 5;
+                continue;
+            }
+        }
+        result += text[i];
+    }
+    return result;
+}
+
+} // namespace
+
+bool KeyboardLayout::load(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        // '#' is a key too: "#<TAB>text" maps it, "# ..." is a comment
+        if (line.size() < 3 || line[1] != '\t') {
+            continue;
+        }
+        auto key = static_cast<unsigned char>(line[0]);
+        std::string text = unescape(line.substr(2));
+        if (key < kFirst || key > kLast || text.empty() ||
+            !lekhika::validateUtf8(text)) {
+            continue;
+        }
+        std::string &slot = keys_[key - kFirst];
+        if (slot.empty()) {
+            ++size_;
+        }
+        slot = std::move(text);
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef LEKHIKA_LAYOUT_H
+#define LEKHIKA_LAYOUT_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+/* ----------  direct keyboard layout  ---------- */
+// Maps each printable key of a US keyboard straight to Devanagari, for
+// typists who learned a Nepali layout rather than Roman spelling. A key
+// is one array lookup; nothing is composed.
+//
+// File format, one key per line:
+//   key<TAB>text
+// The key is the printable ASCII character typed on the US layout, Shift
+// included. "\uXXXX" in the text stands for that code point (for the
+// invisible joiners); lines starting with '#' are comments. A later file
+// loaded into the same layout replaces the keys it lists.
+class KeyboardLayout {
+public:
+    bool load(const std::string &path);
+    bool empty() const { return size_ == 0; }
+
+    // Text for keysym, or nullptr if the layout leaves the key alone.
+    const std::string *map(uint32_t keysym) const {
+        if (keysym < kFirst || keysym > kLast) {
+            return nullptr;
+        }
+        const std::string &text = keys_[keysym - kFirst];
+        return text.empty() ? nullptr : &text;
+    }
+
+private:
+    // Printable ASCII, whose keysyms equal their characters
+    static constexpr uint32_t kFirst = 0x21;
+    static constexpr uint32_t kLast = 0x7E;
+
+    std::array<std::string, kLast - kFirst + 1> keys_;
+    size_t size_ = 0;
+};
+
+#endif // LEKHIKA_LAYOUT_H
@@ -0,0 +1,74 @@
+// lekhika-normalize.cpp
+
+#include "lekhika-normalize.h"
+
+#include <unicode/normalizer2.h>
+#include <unicode/unistr.h>
+
+#include <cstdint>
+
+namespace lekhika {
+
+namespace {
+
+bool isUnstableDevanagari(uint32_t cp) {
+    return cp == 0x093C ||                   // nukta
+           (cp >= 0x0951 && cp <= 0x0954) || // stress signs
+           (cp >= 0x0958 && cp <= 0x095F);   // letters with nukta
+}
+
+} // namespace
+
+bool isNfcFast(const std::string &text) {
+    const auto *p = reinterpret_cast<const uint8_t *>(text.data());
+    const auto *end = p + text.size();
+    while (p < end) {
+        if (*p < 0x80) {
+            ++p;
+            continue;
+        }
+        if (end - p < 3 || (p[0] != 0xE0 && p[0] != 0xE2)) {
+            return false;
+        }
+        if (p[0] == 0xE2) {
+            // ZWNJ and ZWJ only
+            if (p[1] != 0x80 || (p[2] != 0x8C && p[2] != 0x8D)) {
+                return false;
+            }
+        } else {
+            if (p[1] != 0xA4 && p[1] != 0xA5) {
+                return false;
+            }
+            uint32_t cp = 0x0900 + ((p[1] & 0x01u) << 6) + (p[2] & 0x3Fu);
+            if (isUnstableDevanagari(cp)) {
+                return false;
+            }
+        }
+        p += 3;
+    }
+    return true;
+}
+
+std::string toNfc(std::string text) {
+    if (isNfcFast(text)) {
+        return text;
+    }
+    UErrorCode status = U_ZERO_ERROR;
+    const icu::Normalizer2 *nfc = icu::Normalizer2::getNFCInstance(status);
+    if (U_FAILURE(status)) {
+        return text;
+    }
+    auto source = icu::UnicodeString::fromUTF8(text);
+    if (nfc->quickCheck(source, status) == UNORM_YES || U_FAILURE(status)) {
+        return text;
+    }
+    icu::UnicodeString normalized = nfc->normalize(source, status);
+    if (U_FAILURE(status)) {
+        return text;
+    }
+    std::string result;
+    normalized.toUTF8String(result);
+    return result;
+}
+
+} // namespace lekhika
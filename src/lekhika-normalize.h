@@ -0,0 +1,22 @@
+#ifndef LEKHIKA_NORMALIZE_H
+#define LEKHIKA_NORMALIZE_H
+
+#include <string>
+
+// Unicode NFC for text that is committed, learned or indexed, so the same
+// word never ends up in the dictionary twice. Almost everything the engine
+// sees is ASCII or plain Devanagari, which is NFC already; only the rest
+// is handed to ICU.
+namespace lekhika {
+
+// True when text is certainly NFC without asking ICU: ASCII, joiners and
+// Devanagari other than the nukta, the letters that decompose to it and
+// the stress signs, which reorder.
+bool isNfcFast(const std::string &text);
+
+// text in NFC. Text that fails to normalize is returned unchanged.
+std::string toNfc(std::string text);
+
+} // namespace lekhika
+
+#endif // LEKHIKA_NORMALIZE_H
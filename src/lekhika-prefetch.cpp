@@ -0,0 +1,189 @@
+// lekhika-prefetch.cpp
+
+#include "lekhika-prefetch.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <numeric>
+
+namespace {
+
+// Most likely followers of each letter in Roman Nepali, most frequent
+// first. The last row is the word-initial context.
+const char *const kSeedFollowers[] = {
+    "nraimklhsutbdyjgpcvo", // a
+    "aihueroy",             // b
+    "hai",                  // c
+    "aheiuryvo",            // d
+    "nkrlhtsay",            // e
+    "aeiuo",                // f
+    "aheiruyn",             // g
+    "aiueornm",             // h
+    "nkrlsmthyaeu",         // i
+    "aihuyeo",              // j
+    "ahiueorsy",            // k
+    "aeioudyl",             // l
+    "aieuhory",             // m
+    "aeiudtghkcjyo",        // n
+    "rlnkhsmtdga",          // o
+    "ahrieuoly",            // p
+    "u",                    // q
+    "aieuoy",               // r
+    "ahtkiueopmn",          // s
+    "ahiureoyt",            // t
+    "nrlmdkhsta",           // u
+    "aie",                  // v
+    "ai",                   // w
+    "a",                    // x
+    "aoeu",                 // y
+    "a",                    // z
+    "sbkmpatgdnhjrlcuieoy", // word start
+};
+
+// Seed counts are kept small so a few days of real typing outweigh them.
+constexpr uint32_t kSeedScale = 2;
+
+bool startsWith(const std::string &text, const std::string &prefix) {
+    return text.size() >= prefix.size() &&
+           text.compare(0, prefix.size(), prefix) == 0;
+}
+
+} // namespace
+
+  //=============================================================================//
+ // RomanKeyModel Implementation                                                //
+//=============================================================================//
+
+RomanKeyModel::RomanKeyModel() {
+    for (auto &row : counts_) {
+        row.fill(0);
+    }
+    for (int ctx = 0; ctx <= kLetters; ++ctx) {
+        const char *followers = kSeedFollowers[ctx];
+        auto weight = static_cast<uint32_t>(std::strlen(followers));
+        for (const char *p = followers; *p; ++p, --weight) {
+            counts_[ctx][*p - 'a'] += weight * kSeedScale;
+        }
+    }
+}
+
+int RomanKeyModel::contextOf(const std::string &buffer) {
+    if (buffer.empty()) {
+        return kStart;
+    }
+    int c = std::tolower(static_cast<unsigned char>(buffer.back()));
+    return (c >= 'a' && c <= 'z') ? c - 'a' : kStart;
+}
+
+void RomanKeyModel::observe(const std::string &roman) {
+    int ctx = kStart;
+    for (char ch : roman) {
+        int c = std::tolower(static_cast<unsigned char>(ch));
+        if (c < 'a' || c > 'z') {
+            ctx = kStart;
+            continue;
+        }
+        auto &cell = counts_[ctx][c - 'a'];
+        if (cell < UINT32_MAX) {
+            ++cell;
+        }
+        ctx = c - 'a';
+    }
+}
+
+std::vector<char> RomanKeyModel::predictNext(const std::string &buffer,
+                                             size_t n) const {
+    const auto &row = counts_[contextOf(buffer)];
+    std::array<int, kLetters> order;
+    std::iota(order.begin(), order.end(), 0);
+    n = std::min<size_t>(n, kLetters);
+    std::partial_sort(order.begin(), order.begin() + n, order.end(),
+                      [&row](int a, int b) { return row[a] > row[b]; });
+
+    std::vector<char> result;
+    for (size_t i = 0; i < n && row[order[i]] > 0; ++i) {
+        result.push_back(static_cast<char>('a' + order[i]));
+    }
+    return result;
+}
+
+  //=============================================================================//
+ // SpeculativeCache Implementation                                             //
+//=============================================================================//
+
+const SpeculativeEntry *
+SpeculativeCache::find(const std::string &buffer) const {
+    auto it = entries_.find(buffer);
+    return it == entries_.end() ? nullptr : &it->second;
+}
+
+SpeculativeEntry &SpeculativeCache::insert(const std::string &buffer) {
+    auto it = entries_.find(buffer);
+    if (it != entries_.end()) {
+        return it->second;
+    }
+    while (entries_.size() >= capacity_ && !order_.empty()) {
+        entries_.erase(order_.front());
+        order_.pop_front();
+    }
+    order_.push_back(buffer);
+    return entries_[buffer];
+}
+
+void SpeculativeCache::clearSuggestions() {
+    for (auto &item : entries_) {
+        item.second.suggestions.clear();
+        item.second.hasSuggestions = false;
+    }
+}
+
+void SpeculativeCache::clear() {
+    entries_.clear();
+    order_.clear();
+}
+
+  //=============================================================================//
+ // CompletionCache Implementation                                              //
+//=============================================================================//
+
+void CompletionCache::trimTo(const std::string &prefix) {
+    while (!path_.empty() && !startsWith(prefix, path_.back().prefix)) {
+        path_.pop_back();
+    }
+}
+
+const std::string *CompletionCache::find(const std::string &prefix,
+                                         bool carry) {
+    trimTo(prefix);
+    if (path_.empty()) {
+        return nullptr;
+    }
+    const auto &last = path_.back();
+    if (last.prefix == prefix) {
+        return &last.word;
+    }
+    if (!carry) {
+        return nullptr;
+    }
+    if (last.noWords) {
+        path_.push_back({prefix, {}, true});
+        return &path_.back().word;
+    }
+    if (last.word.size() > prefix.size() && startsWith(last.word, prefix)) {
+        path_.push_back({prefix, last.word});
+        return &path_.back().word;
+    }
+    return nullptr;
+}
+
+void CompletionCache::store(const std::string &prefix, std::string word,
+                            bool noWords) {
+    trimTo(prefix);
+    if (!path_.empty() && path_.back().prefix == prefix) {
+        path_.back().word = std::move(word);
+        path_.back().noWords = noWords;
+    } else {
+        path_.push_back({prefix, std::move(word), noWords});
+    }
+}
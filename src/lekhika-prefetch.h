@@ -0,0 +1,88 @@
+#ifndef LEKHIKA_PREFETCH_H
+#define LEKHIKA_PREFETCH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* ----------  Roman key bigram model  ---------- */
+// Predicts the next Roman key from the last one typed. Seeded with the
+// usual letter statistics of Roman Nepali and refined by every word the
+// user commits.
+class RomanKeyModel {
+public:
+    RomanKeyModel();
+
+    void observe(const std::string &roman);
+    std::vector<char> predictNext(const std::string &buffer, size_t n) const;
+
+private:
+    static constexpr int kLetters = 26;
+    static constexpr int kStart = kLetters; // context at a word boundary
+
+    static int contextOf(const std::string &buffer);
+
+    std::array<std::array<uint32_t, kLetters>, kLetters + 1> counts_;
+};
+
+/* ----------  speculative results cache  ---------- */
+struct SpeculativeEntry {
+    std::string preview;                  // transliteration of the buffer
+    std::vector<std::string> suggestions; // dictionary lookup for preview
+    bool hasSuggestions = false;
+    std::vector<std::string> variants;    // transliterated respellings
+    bool hasVariants = false;
+};
+
+// Small FIFO-bounded cache of work computed ahead of time, keyed by the
+// Roman buffer it belongs to.
+class SpeculativeCache {
+public:
+    explicit SpeculativeCache(size_t capacity = 32) : capacity_(capacity) {}
+
+    const SpeculativeEntry *find(const std::string &buffer) const;
+    SpeculativeEntry &insert(const std::string &buffer);
+    void clearSuggestions();
+    void clear();
+
+private:
+    size_t capacity_;
+    std::unordered_map<std::string, SpeculativeEntry> entries_;
+    std::deque<std::string> order_;
+};
+
+/* ----------  top completion along the typing path  ---------- */
+// The best completion of a prefix (the best word that is longer than it) is
+// also the best completion of any longer prefix it still extends, and a
+// prefix no word starts with has none for anything longer. Keeping the answers for the prefixes typed so far
+// answers most keystrokes, forward or Backspace, without a lookup.
+class CompletionCache {
+public:
+    // Best completion of prefix ("" for none), or nullptr if unknown.
+    // Without carry only an answer stored for prefix itself is returned:
+    // a prefix with boosted picks ranks its own way, so a shorter prefix's
+    // answer does not hold for it.
+    const std::string *find(const std::string &prefix, bool carry = true);
+    // noWords: the lookup found no word at all for prefix, so an empty
+    // answer also holds for longer prefixes. An empty answer that only
+    // means the top rows were unusable is kept for prefix alone.
+    void store(const std::string &prefix, std::string word,
+               bool noWords = false);
+    void clear() { path_.clear(); }
+
+private:
+    struct Step {
+        std::string prefix;
+        std::string word;
+        bool noWords = false;
+    };
+    void trimTo(const std::string &prefix);
+
+    std::vector<Step> path_; // each prefix extends the one before it
+};
+
+#endif // LEKHIKA_PREFETCH_H
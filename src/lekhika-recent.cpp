@@ -0,0 +1,101 @@
+// lekhika-recent.cpp
+
+#include "lekhika-recent.h"
+#include "lekhika-snapshot.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+namespace {
+
+// A use counts half as much after this many further commits
+constexpr double kHalfLife = 400.0;
+
+} // namespace
+
+double RecentWords::score(const Entry &entry) const {
+    double age = static_cast<double>(clock_ - entry.lastUsed);
+    return entry.uses * std::exp2(-age / kHalfLife);
+}
+
+bool RecentWords::load(const std::string &path) {
+    SnapshotReader reader;
+    if (!reader.open(path)) {
+        return false;
+    }
+    words_.clear();
+    clock_ = 0;
+    // Records come in key order, so every insert lands at the end
+    for (const auto &match : reader.scanPrefix({}, reader.size())) {
+        Entry entry;
+        entry.uses = match.weight;
+        std::from_chars(match.value.data(),
+                        match.value.data() + match.value.size(), entry.lastUsed);
+        clock_ = std::max(clock_, entry.lastUsed);
+        words_.emplace_hint(words_.end(), std::string(match.key), entry);
+    }
+    dirty_ = false;
+    return true;
+}
+
+bool RecentWords::save(const std::string &path) {
+    std::vector<SnapshotEntry> entries;
+    entries.reserve(words_.size());
+    for (const auto &item : words_) {
+        entries.push_back({item.first, std::to_string(item.second.lastUsed),
+                           item.second.uses});
+    }
+    if (!publishSnapshot(path, std::move(entries))) {
+        return false;
+    }
+    dirty_ = false;
+    return true;
+}
+
+void RecentWords::touch(const std::string &word) {
+    auto &entry = words_[word];
+    ++entry.uses;
+    entry.lastUsed = ++clock_;
+    dirty_ = true;
+    if (words_.size() > capacity_) {
+        evict();
+    }
+}
+
+void RecentWords::evict() {
+    auto victim = words_.end();
+    double lowest = 0;
+    for (auto it = words_.begin(); it != words_.end(); ++it) {
+        double value = score(it->second);
+        if (it->second.lastUsed != clock_ &&
+            (victim == words_.end() || value < lowest)) {
+            victim = it;
+            lowest = value;
+        }
+    }
+    if (victim != words_.end()) {
+        words_.erase(victim);
+    }
+}
+
+std::vector<RecentWords::Match>
+RecentWords::find(const std::string &prefix, size_t limit) const {
+    std::vector<Match> matches;
+    for (auto it = words_.lower_bound(prefix);
+         it != words_.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+         ++it) {
+        matches.push_back({it->first, score(it->second), it->second.uses});
+    }
+    auto better = [](const Match &a, const Match &b) {
+        return a.score > b.score;
+    };
+    if (matches.size() > limit) {
+        std::partial_sort(matches.begin(), matches.begin() + limit,
+                          matches.end(), better);
+        matches.resize(limit);
+    } else {
+        std::sort(matches.begin(), matches.end(), better);
+    }
+    return matches;
+}
@@ -0,0 +1,49 @@
+#ifndef LEKHIKA_RECENT_H
+#define LEKHIKA_RECENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/* ----------  recently used words  ---------- */
+// A few thousand words the user committed lately, kept in memory and
+// saved as a snapshot file, so loading it at startup is one mmap and a
+// copy. It answers suggestions before any dictionary has been opened.
+// Words are ranked by use count decayed by how many commits ago they were
+// last used; the least valuable word is dropped when the list is full.
+class RecentWords {
+public:
+    struct Match {
+        std::string word;
+        double score;
+        uint32_t uses;
+    };
+
+    explicit RecentWords(size_t capacity = 4096) : capacity_(capacity) {}
+
+    bool load(const std::string &path);
+    bool save(const std::string &path);
+    bool dirty() const { return dirty_; }
+
+    void touch(const std::string &word);
+    // Best recent words starting with prefix.
+    std::vector<Match> find(const std::string &prefix, size_t limit) const;
+
+private:
+    struct Entry {
+        uint32_t uses = 0;
+        uint64_t lastUsed = 0; // value of clock_ at the last use
+    };
+
+    double score(const Entry &entry) const;
+    void evict();
+
+    size_t capacity_;
+    std::map<std::string, Entry> words_; // ordered for prefix ranges
+    uint64_t clock_ = 0;                 // counts touches
+    bool dirty_ = false;
+};
+
+#endif // LEKHIKA_RECENT_H
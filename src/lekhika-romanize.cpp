@@ -0,0 +1,190 @@
+// lekhika-romanize.cpp
+
+#include "lekhika-romanize.h"
+
+#include <array>
+#include <cstdint>
+
+namespace lekhika {
+
+namespace {
+
+enum class Kind : uint8_t {
+    Other,     // copied through
+    Letter,    // independent vowel, sign, digit or punctuation
+    Consonant, // carries an inherent "a"
+    VowelSign, // replaces the inherent "a"
+    Halant,    // drops the inherent "a"
+    Nukta,     // handled with the consonant before it
+};
+
+struct Entry {
+    Kind kind = Kind::Other;
+    const char *roman = "";
+    // Roman of consonant + nukta, for the consonants that have one
+    const char *nukta = nullptr;
+};
+
+using Table = std::array<Entry, 0x80>;
+
+Table buildTable() {
+    Table t;
+    auto set = [&t](uint32_t cp, Kind kind, const char *roman) {
+        t[cp - 0x0900] = {kind, roman, nullptr};
+    };
+
+    const char *const vowels[] = {
+        "a", "ā", "i", "ī", "u", "ū", "r̥", "l̥", "ê", "ĕ", "e", "ai",
+        "ô", "ŏ", "o", "au"};
+    for (uint32_t i = 0; i < 16; ++i) {
+        set(0x0905 + i, Kind::Letter, vowels[i]);
+    }
+    set(0x0960, Kind::Letter, "r̥̄");
+    set(0x0961, Kind::Letter, "l̥̄");
+
+    const char *const signs[] = {
+        "ā", "i", "ī", "u", "ū", "r̥", "r̥̄", "ê", "ĕ", "e", "ai",
+        "ô", "ŏ", "o", "au"};
+    for (uint32_t i = 0; i < 15; ++i) {
+        set(0x093E + i, Kind::VowelSign, signs[i]);
+    }
+    set(0x0962, Kind::VowelSign, "l̥");
+    set(0x0963, Kind::VowelSign, "l̥̄");
+
+    const char *const consonants[] = {
+        "k", "kh", "g", "gh", "ṅ", "c", "ch", "j", "jh", "ñ",
+        "ṭ", "ṭh", "ḍ", "ḍh", "ṇ", "t", "th", "d", "dh", "n",
+        "ṉ", "p", "ph", "b", "bh", "m", "y", "r", "ṟ", "l",
+        "ḷ", "ḻ", "v", "ś", "ṣ", "s", "h"};
+    for (uint32_t i = 0; i < 37; ++i) {
+        set(0x0915 + i, Kind::Consonant, consonants[i]);
+    }
+
+    // Precomposed nukta letters, and the same letters spelled out
+    const std::pair<uint32_t, const char *> nuktas[] = {
+        {0x0915, "q"}, {0x0916, "k͟h"}, {0x0917, "ġ"}, {0x091C, "z"},
+        {0x0921, "ṛ"}, {0x0922, "ṛh"}, {0x092B, "f"}, {0x092F, "ẏ"}};
+    for (uint32_t i = 0; i < 8; ++i) {
+        set(0x0958 + i, Kind::Consonant, nuktas[i].second);
+        t[nuktas[i].first - 0x0900].nukta = nuktas[i].second;
+    }
+    // These three compose in NFC, but may arrive spelled out
+    t[0x0928 - 0x0900].nukta = "ṉ";
+    t[0x0930 - 0x0900].nukta = "ṟ";
+    t[0x0933 - 0x0900].nukta = "ḻ";
+
+    set(0x0901, Kind::Letter, "m̐");
+    set(0x0902, Kind::Letter, "ṁ");
+    set(0x0903, Kind::Letter, "ḥ");
+    set(0x093C, Kind::Nukta, "");
+    set(0x093D, Kind::Letter, "’");
+    set(0x094D, Kind::Halant, "");
+    set(0x0950, Kind::Letter, "oṁ");
+    set(0x0964, Kind::Letter, ".");
+    set(0x0965, Kind::Letter, "..");
+    set(0x0970, Kind::Letter, ".");
+    const char *const digits[] = {"0", "1", "2", "3", "4",
+                                  "5", "6", "7", "8", "9"};
+    for (uint32_t i = 0; i < 10; ++i) {
+        set(0x0966 + i, Kind::Letter, digits[i]);
+    }
+    return t;
+}
+
+const Table &table() {
+    static const Table t = buildTable();
+    return t;
+}
+
+// Offset of the Devanagari code point at p into the table, or -1
+int devanagariAt(const uint8_t *p, const uint8_t *end) {
+    if (end - p < 3 || p[0] != 0xE0 || (p[1] != 0xA4 && p[1] != 0xA5)) {
+        return -1;
+    }
+    return ((p[1] & 0x01) << 6) | (p[2] & 0x3F);
+}
+
+bool isJoiner(const uint8_t *p, const uint8_t *end) {
+    return end - p >= 3 && p[0] == 0xE2 && p[1] == 0x80 &&
+           (p[2] == 0x8C || p[2] == 0x8D);
+}
+
+} // namespace
+
+std::string romanize(const std::string &text) {
+    const Table &t = table();
+    std::string out;
+    out.reserve(text.size());
+
+    const auto *p = reinterpret_cast<const uint8_t *>(text.data());
+    const auto *end = p + text.size();
+    // A consonant was written and its inherent "a" is still owed
+    bool pendingA = false;
+    while (p < end) {
+        int index = devanagariAt(p, end);
+        if (index < 0) {
+            if (isJoiner(p, end)) {
+                p += 3;
+                continue;
+            }
+            if (pendingA) {
+                out += 'a';
+                pendingA = false;
+            }
+            // Copy up to the next Devanagari lead byte in one go
+            const auto *next = p + 1;
+            while (next < end && *next != 0xE0 && *next != 0xE2) {
+                ++next;
+            }
+            out.append(reinterpret_cast<const char *>(p), next - p);
+            p = next;
+            continue;
+        }
+
+        const Entry &entry = t[index];
+        p += 3;
+        switch (entry.kind) {
+        case Kind::Consonant: {
+            if (pendingA) {
+                out += 'a';
+            }
+            int after = devanagariAt(p, end);
+            if (entry.nukta && after == 0x3C) {
+                out += entry.nukta;
+                p += 3;
+            } else {
+                out += entry.roman;
+            }
+            pendingA = true;
+            break;
+        }
+        case Kind::VowelSign:
+            out += entry.roman;
+            pendingA = false;
+            break;
+        case Kind::Halant:
+            pendingA = false;
+            break;
+        case Kind::Nukta:
+            break;
+        case Kind::Letter:
+        case Kind::Other:
+            if (pendingA) {
+                out += 'a';
+                pendingA = false;
+            }
+            if (entry.kind == Kind::Letter) {
+                out += entry.roman;
+            } else {
+                out.append(reinterpret_cast<const char *>(p - 3), 3);
+            }
+            break;
+        }
+    }
+    if (pendingA) {
+        out += 'a';
+    }
+    return out;
+}
+
+} // namespace lekhika
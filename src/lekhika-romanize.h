@@ -0,0 +1,19 @@
+#ifndef LEKHIKA_ROMANIZE_H
+#define LEKHIKA_ROMANIZE_H
+
+#include <string>
+
+// Devanagari back to Roman letters, ISO 15919 style, for searching and
+// for metadata. Each code point is looked up in a table built once, so a
+// document converts in a single pass; text that is not Devanagari is
+// copied as it is.
+namespace lekhika {
+
+// text romanized. Consonants keep their inherent "a" unless a halant or a
+// vowel sign follows, ए and ओ are written e and o, and a nukta letter such
+// as क़ is given its own letter whether it is precomposed or not.
+std::string romanize(const std::string &text);
+
+} // namespace lekhika
+
+#endif // LEKHIKA_ROMANIZE_H
@@ -0,0 +1,114 @@
+// lekhika-scan.cpp
+
+#include "lekhika-scan.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace lekhika {
+
+namespace {
+
+// Same set as keyEvent's commitSymbols, plus '/'. All of it falls in six
+// ASCII ranges, which is what the vector path tests.
+const char kCommitSymbols[] = R"(!@#$%^()-_=+[]{};:'",.<>?|\/)";
+
+RomanRunKind classify(unsigned char c) {
+    if (c >= '0' && c <= '9') {
+        return RomanRunKind::Digit;
+    }
+    if (c <= ' ') {
+        return RomanRunKind::Space;
+    }
+    if (isCommitSymbol(static_cast<char>(c))) {
+        return RomanRunKind::Symbol;
+    }
+    return RomanRunKind::Word;
+}
+
+void pushRun(std::vector<RomanRun> &runs, RomanRunKind kind, size_t pos) {
+    if (!runs.empty() && runs.back().kind == kind) {
+        ++runs.back().length;
+    } else {
+        runs.push_back({kind, pos, 1});
+    }
+}
+
+#ifdef __SSE2__
+
+inline __m128i inRange(__m128i v, char lo, char hi) {
+    // Signed compares are fine: every bound is ASCII and bytes >= 0x80 are
+    // negative, so they never match.
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+// Per-byte RomanRunKind for sixteen bytes.
+inline __m128i classifyBlock(__m128i v) {
+    __m128i digit = inRange(v, '0', '9');
+    __m128i space = _mm_and_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(' ' + 1)),
+                                  _mm_cmpgt_epi8(v, _mm_set1_epi8(-1)));
+    __m128i symbol = _mm_or_si128(
+        _mm_or_si128(_mm_or_si128(inRange(v, '!', '%'), inRange(v, '\'', ')')),
+                     _mm_or_si128(inRange(v, '+', '/'), inRange(v, ':', '@'))),
+        _mm_or_si128(inRange(v, '[', '_'), inRange(v, '{', '}')));
+    return _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(
+                                              static_cast<char>(RomanRunKind::Digit))),
+                     _mm_and_si128(symbol, _mm_set1_epi8(static_cast<char>(
+                                               RomanRunKind::Symbol)))),
+        _mm_and_si128(space,
+                      _mm_set1_epi8(static_cast<char>(RomanRunKind::Space))));
+}
+
+#endif // __SSE2__
+
+} // namespace
+
+bool isCommitSymbol(char c) {
+    return c != '\0' && std::strchr(kCommitSymbols, c) != nullptr;
+}
+
+std::vector<RomanRun> splitRomanRuns(const std::string &text) {
+    std::vector<RomanRun> runs;
+    const auto *data = reinterpret_cast<const unsigned char *>(text.data());
+    const size_t size = text.size();
+    size_t i = 0;
+
+#ifdef __SSE2__
+    alignas(16) uint8_t kinds[16];
+    while (size - i >= 16) {
+        __m128i block = classifyBlock(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)));
+        // A block of a single kind, usually letters, extends the last run
+        // or opens a new one without looking at each byte.
+        __m128i first = _mm_set1_epi8(static_cast<char>(
+            _mm_cvtsi128_si32(block) & 0xFF));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, first)) == 0xFFFF) {
+            auto kind = static_cast<RomanRunKind>(
+                _mm_cvtsi128_si32(block) & 0xFF);
+            if (!runs.empty() && runs.back().kind == kind) {
+                runs.back().length += 16;
+            } else {
+                runs.push_back({kind, i, 16});
+            }
+        } else {
+            _mm_store_si128(reinterpret_cast<__m128i *>(kinds), block);
+            for (size_t k = 0; k < 16; ++k) {
+                pushRun(runs, static_cast<RomanRunKind>(kinds[k]), i + k);
+            }
+        }
+        i += 16;
+    }
+#endif
+
+    for (; i < size; ++i) {
+        pushRun(runs, classify(data[i]), i);
+    }
+    return runs;
+}
+
+} // namespace lekhika
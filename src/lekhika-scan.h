@@ -0,0 +1,31 @@
+#ifndef LEKHIKA_SCAN_H
+#define LEKHIKA_SCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lekhika {
+
+// Input classes as keyEvent sees them: letters (and anything else it would
+// buffer), digits, symbols that commit the buffer (including '/'), and
+// whitespace that reaches the application unchanged.
+enum class RomanRunKind : uint8_t { Word, Digit, Symbol, Space };
+
+struct RomanRun {
+    RomanRunKind kind;
+    size_t begin;
+    size_t length;
+};
+
+// Characters that end the current word when typed.
+bool isCommitSymbol(char c);
+
+// Splits text into maximal runs of one kind, sixteen bytes at a time where
+// SSE2 is available.
+std::vector<RomanRun> splitRomanRuns(const std::string &text);
+
+} // namespace lekhika
+
+#endif // LEKHIKA_SCAN_H
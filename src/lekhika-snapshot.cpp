@@ -0,0 +1,284 @@
+// lekhika-snapshot.cpp
+
+#include "lekhika-snapshot.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+
+namespace {
+
+constexpr char kMagic[8] = {'L', 'K', 'S', 'N', 'A', 'P', '\0', '\0'};
+constexpr uint32_t kVersion = 2;
+
+int64_t mtimeOf(const struct stat &st) {
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+           st.st_mtim.tv_nsec;
+}
+
+bool writeAll(int fd, const void *data, size_t length) {
+    const auto *p = static_cast<const char *>(data);
+    while (length > 0) {
+        ssize_t n = ::write(fd, p, length);
+        if (n < 0) {
+            return false;
+        }
+        p += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+uint64_t currentGeneration(const std::string &path) {
+    SnapshotHeader header{};
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    bool ok = ::read(fd, &header, sizeof(header)) == sizeof(header) &&
+              std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0;
+    ::close(fd);
+    return ok ? header.generation : 0;
+}
+
+} // namespace
+
+  //=============================================================================//
+ // Writer                                                                      //
+//=============================================================================//
+
+uint64_t fileStamp(const std::string &path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    auto stamp = static_cast<uint64_t>(mtimeOf(st));
+    stamp ^= static_cast<uint64_t>(st.st_size) + 0x9E3779B97F4A7C15ull +
+             (stamp << 6) + (stamp >> 2);
+    return stamp ? stamp : 1;
+}
+
+bool publishSnapshot(const std::string &path, std::vector<SnapshotEntry> entries,
+                     uint64_t source) {
+    std::sort(entries.begin(), entries.end(),
+              [](const SnapshotEntry &a, const SnapshotEntry &b) {
+                  return a.key != b.key ? a.key < b.key : a.weight > b.weight;
+              });
+    entries.erase(std::unique(entries.begin(), entries.end(),
+                              [](const SnapshotEntry &a, const SnapshotEntry &b) {
+                                  return a.key == b.key;
+                              }),
+                  entries.end());
+
+    std::vector<SnapshotRecord> records;
+    records.reserve(entries.size());
+    std::string pool;
+    for (const auto &entry : entries) {
+        SnapshotRecord record{};
+        record.keyOffset = static_cast<uint32_t>(pool.size());
+        record.keyLength = static_cast<uint32_t>(entry.key.size());
+        pool += entry.key;
+        record.valueOffset = static_cast<uint32_t>(pool.size());
+        record.valueLength = static_cast<uint32_t>(entry.value.size());
+        pool += entry.value;
+        record.weight = entry.weight;
+        records.push_back(record);
+    }
+    if (pool.size() > UINT32_MAX) {
+        return false;
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.count = static_cast<uint32_t>(records.size());
+    header.generation = currentGeneration(path) + 1;
+    header.poolSize = pool.size();
+    header.source = source;
+
+    // Write beside the target and rename over it: readers either see the
+    // old file or the complete new one.
+    std::string tmpPath = path + ".tmp." + std::to_string(::getpid());
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = writeAll(fd, &header, sizeof(header)) &&
+              writeAll(fd, records.data(),
+                       records.size() * sizeof(SnapshotRecord)) &&
+              writeAll(fd, pool.data(), pool.size()) && ::fsync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+    if (!ok || ::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        ::unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+  //=============================================================================//
+ // Reader                                                                      //
+//=============================================================================//
+
+SnapshotReader::~SnapshotReader() { close(); }
+
+void SnapshotReader::close() {
+    if (data_) {
+        ::munmap(data_, length_);
+    }
+    data_ = nullptr;
+    length_ = 0;
+    inode_ = 0;
+    mtimeNs_ = 0;
+    header_ = nullptr;
+    records_ = nullptr;
+    pool_ = nullptr;
+}
+
+bool SnapshotReader::open(const std::string &path) {
+    path_ = path;
+    close();
+    return map(path);
+}
+
+bool SnapshotReader::refresh() {
+    if (path_.empty()) {
+        return false;
+    }
+    struct stat st;
+    if (::stat(path_.c_str(), &st) != 0) {
+        return false;
+    }
+    if (isOpen() && st.st_ino == inode_ && mtimeOf(st) == mtimeNs_) {
+        return false;
+    }
+    uint64_t oldGeneration = generation();
+    SnapshotReader next;
+    if (!next.map(path_)) {
+        return false;
+    }
+    close();
+    std::swap(data_, next.data_);
+    std::swap(length_, next.length_);
+    inode_ = next.inode_;
+    mtimeNs_ = next.mtimeNs_;
+    header_ = next.header_;
+    records_ = next.records_;
+    pool_ = next.pool_;
+    next.header_ = nullptr;
+    return generation() != oldGeneration;
+}
+
+bool SnapshotReader::map(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        return false;
+    }
+    auto length = static_cast<size_t>(st.st_size);
+    void *data = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    // Never trust offsets from a file another process wrote
+    const auto *header = static_cast<const SnapshotHeader *>(data);
+    size_t recordsSize = size_t(header->count) * sizeof(SnapshotRecord);
+    bool ok = std::memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 &&
+              header->version == kVersion &&
+              sizeof(SnapshotHeader) + recordsSize <= length &&
+              header->poolSize == length - sizeof(SnapshotHeader) - recordsSize;
+    const auto *records = reinterpret_cast<const SnapshotRecord *>(header + 1);
+    for (uint32_t i = 0; ok && i < header->count; ++i) {
+        const auto &r = records[i];
+        ok = uint64_t(r.keyOffset) + r.keyLength <= header->poolSize &&
+             uint64_t(r.valueOffset) + r.valueLength <= header->poolSize;
+    }
+    if (!ok) {
+        ::munmap(data, length);
+        return false;
+    }
+
+    data_ = data;
+    length_ = length;
+    inode_ = st.st_ino;
+    mtimeNs_ = mtimeOf(st);
+    header_ = header;
+    records_ = records;
+    pool_ = reinterpret_cast<const char *>(records + header->count);
+    return true;
+}
+
+std::string_view SnapshotReader::key(const SnapshotRecord &record) const {
+    return {pool_ + record.keyOffset, record.keyLength};
+}
+
+SnapshotReader::Match SnapshotReader::match(const SnapshotRecord &record) const {
+    return {key(record), {pool_ + record.valueOffset, record.valueLength},
+            record.weight};
+}
+
+const SnapshotRecord *SnapshotReader::lowerBound(std::string_view prefix) const {
+    return std::lower_bound(records_, records_ + header_->count, prefix,
+                            [this](const SnapshotRecord &r, std::string_view p) {
+                                return key(r) < p;
+                            });
+}
+
+std::vector<SnapshotReader::Match>
+SnapshotReader::scanPrefix(std::string_view prefix, size_t limit) const {
+    std::vector<Match> result;
+    if (!isOpen()) {
+        return result;
+    }
+    const SnapshotRecord *end = records_ + header_->count;
+    for (const auto *r = lowerBound(prefix);
+         r != end && result.size() < limit &&
+         key(*r).substr(0, prefix.size()) == prefix;
+         ++r) {
+        result.push_back(match(*r));
+    }
+    return result;
+}
+
+std::vector<SnapshotReader::Match>
+SnapshotReader::findPrefix(std::string_view prefix, size_t limit) const {
+    std::vector<Match> result;
+    if (!isOpen() || limit == 0) {
+        return result;
+    }
+
+    // Bounded min-heap over the matching key range
+    auto worse = [](const Match &a, const Match &b) {
+        return a.weight != b.weight ? a.weight > b.weight : a.key < b.key;
+    };
+    std::priority_queue<Match, std::vector<Match>, decltype(worse)> best(worse);
+    const SnapshotRecord *end = records_ + header_->count;
+    for (const auto *r = lowerBound(prefix);
+         r != end && key(*r).substr(0, prefix.size()) == prefix; ++r) {
+        if (best.size() < limit) {
+            best.push(match(*r));
+        } else if (r->weight > best.top().weight) {
+            best.pop();
+            best.push(match(*r));
+        }
+    }
+
+    result.resize(best.size());
+    for (auto it = result.rbegin(); it != result.rend(); ++it) {
+        *it = best.top();
+        best.pop();
+    }
+    return result;
+}
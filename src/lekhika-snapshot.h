@@ -0,0 +1,101 @@
+#ifndef LEKHIKA_SNAPSHOT_H
+#define LEKHIKA_SNAPSHOT_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* ----------  read-only sorted word index on disk  ---------- */
+// A snapshot is a single file holding records sorted by key, each with an
+// optional value and a weight. Writers build a new file next to the old
+// one and rename it into place, so readers that still map the previous
+// generation are never disturbed and never wait for a lock.
+//
+// Layout (host byte order):
+//   SnapshotHeader | SnapshotRecord[count] | string pool
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t generation;
+    uint64_t poolSize;
+    // What the snapshot was built from, as fileStamp() saw it; 0 if unknown
+    uint64_t source;
+};
+
+struct SnapshotRecord {
+    uint32_t keyOffset;
+    uint32_t keyLength;
+    uint32_t valueOffset;
+    uint32_t valueLength;
+    uint32_t weight;
+    uint32_t reserved;
+};
+
+struct SnapshotEntry {
+    std::string key;
+    std::string value;
+    uint32_t weight = 0;
+};
+
+// Writes entries as the next generation of the snapshot at path. Duplicate
+// keys keep their highest weight. Returns false if nothing was published.
+bool publishSnapshot(const std::string &path, std::vector<SnapshotEntry> entries,
+                     uint64_t source = 0);
+
+// Size and modification time of the file at path folded into one value,
+// or 0 when there is no such file. A snapshot whose source differs from
+// the stamp of the file it was built from is stale.
+uint64_t fileStamp(const std::string &path);
+
+class SnapshotReader {
+public:
+    struct Match {
+        std::string_view key;
+        std::string_view value;
+        uint32_t weight;
+    };
+
+    SnapshotReader() = default;
+    ~SnapshotReader();
+    SnapshotReader(const SnapshotReader &) = delete;
+    SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+    bool open(const std::string &path);
+    // Maps a newer file if one was renamed over path. Returns true when the
+    // generation changed.
+    bool refresh();
+    void close();
+
+    bool isOpen() const { return header_ != nullptr; }
+    uint64_t generation() const { return header_ ? header_->generation : 0; }
+    uint64_t source() const { return header_ ? header_->source : 0; }
+    size_t size() const { return header_ ? header_->count : 0; }
+
+    // Highest-weight records whose key starts with prefix, best first.
+    std::vector<Match> findPrefix(std::string_view prefix, size_t limit) const;
+    // Records whose key starts with prefix, in key order.
+    std::vector<Match> scanPrefix(std::string_view prefix, size_t limit) const;
+
+private:
+    bool map(const std::string &path);
+    std::string_view key(const SnapshotRecord &record) const;
+    Match match(const SnapshotRecord &record) const;
+    const SnapshotRecord *lowerBound(std::string_view prefix) const;
+
+    std::string path_;
+    void *data_ = nullptr;
+    size_t length_ = 0;
+    ino_t inode_ = 0;
+    int64_t mtimeNs_ = 0;
+    const SnapshotHeader *header_ = nullptr;
+    const SnapshotRecord *records_ = nullptr;
+    const char *pool_ = nullptr;
+};
+
+#endif // LEKHIKA_SNAPSHOT_H
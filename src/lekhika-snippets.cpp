@@ -0,0 +1,158 @@
+// lekhika-snippets.cpp
+
+#include "lekhika-snippets.h"
+#include "lekhika-utf8.h"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+
+namespace {
+
+std::string unescape(const std::string &text) {
+    std::string result;
+    result.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\\' && i + 1 < text.size()) {
+            char next = text[i + 1];
+            if (next == 'n' || next == 't' || next == '\\') {
+                result += next == 'n' ? '\n' : next == 't' ? '\t' : '\\';
+                ++i;
+                continue;
+            }
+        }
+        result += text[i];
+    }
+    return result;
+}
+
+} // namespace
+
+void SnippetTable::clear() {
+    nodes_.assign(1, Node());
+    expansions_.clear();
+}
+
+bool SnippetTable::load(const std::string &path) {
+    clear();
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        auto tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == std::string::npos ||
+            tab == 0) {
+            continue;
+        }
+        std::string expansion = unescape(line.substr(tab + 1));
+        if (expansion.empty() || !lekhika::validateUtf8(expansion)) {
+            continue;
+        }
+        insert(line.substr(0, tab), static_cast<int32_t>(expansions_.size()));
+        expansions_.push_back(std::move(expansion));
+    }
+    buildLinks();
+    return true;
+}
+
+int32_t SnippetTable::child(int32_t node, unsigned char c) const {
+    const auto &next = nodes_[node].next;
+    auto it = std::lower_bound(
+        next.begin(), next.end(), c,
+        [](const std::pair<unsigned char, int32_t> &e, unsigned char v) {
+            return e.first < v;
+        });
+    return (it != next.end() && it->first == c) ? it->second : -1;
+}
+
+void SnippetTable::insert(const std::string &trigger, int32_t snippet) {
+    int32_t node = 0;
+    for (unsigned char c : trigger) {
+        int32_t next = child(node, c);
+        if (next < 0) {
+            next = static_cast<int32_t>(nodes_.size());
+            Node created;
+            created.depth = nodes_[node].depth + 1;
+            nodes_.push_back(std::move(created));
+            auto &edges = nodes_[node].next;
+            edges.insert(std::upper_bound(edges.begin(), edges.end(),
+                                          std::make_pair(c, next)),
+                         {c, next});
+        }
+        node = next;
+    }
+    // A repeated trigger keeps its first expansion
+    if (nodes_[node].output < 0) {
+        nodes_[node].output = snippet;
+    }
+}
+
+void SnippetTable::buildLinks() {
+    // Breadth-first, so every fail target is finished before it is used
+    std::deque<int32_t> queue;
+    for (const auto &edge : nodes_[0].next) {
+        nodes_[edge.second].fail = 0;
+        queue.push_back(edge.second);
+    }
+    while (!queue.empty()) {
+        int32_t node = queue.front();
+        queue.pop_front();
+        for (const auto &edge : nodes_[node].next) {
+            int32_t target = edge.second;
+            nodes_[target].fail = step(nodes_[node].fail, edge.first);
+            int32_t fail = nodes_[target].fail;
+            nodes_[target].outputLink =
+                nodes_[fail].output >= 0 ? fail : nodes_[fail].outputLink;
+            queue.push_back(target);
+        }
+    }
+}
+
+int32_t SnippetTable::step(int32_t node, unsigned char c) const {
+    while (true) {
+        int32_t next = child(node, c);
+        if (next >= 0) {
+            return next;
+        }
+        if (node == 0) {
+            return 0;
+        }
+        node = nodes_[node].fail;
+    }
+}
+
+std::vector<SnippetTable::Match>
+SnippetTable::matchSuffixes(const std::string &buffer) const {
+    std::vector<Match> matches;
+    if (empty()) {
+        return matches;
+    }
+    int32_t node = 0;
+    for (unsigned char c : buffer) {
+        node = step(node, c);
+    }
+    // The output chain runs from the longest suffix to the shortest
+    for (int32_t at = nodes_[node].output >= 0 ? node : nodes_[node].outputLink;
+         at >= 0; at = nodes_[at].outputLink) {
+        matches.push_back({buffer.size() - nodes_[at].depth,
+                           &expansions_[nodes_[at].output]});
+    }
+    return matches;
+}
+
+const std::string *SnippetTable::exactMatch(const std::string &buffer) const {
+    if (empty()) {
+        return nullptr;
+    }
+    int32_t node = 0;
+    for (unsigned char c : buffer) {
+        node = child(node, c);
+        if (node < 0) {
+            return nullptr;
+        }
+    }
+    return nodes_[node].output >= 0 ? &expansions_[nodes_[node].output]
+                                    : nullptr;
+}
@@ -0,0 +1,54 @@
+#ifndef LEKHIKA_SNIPPETS_H
+#define LEKHIKA_SNIPPETS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* ----------  user snippets matched on the Roman buffer  ---------- */
+// Maps Roman triggers to ready-made text. Triggers are compiled into an
+// Aho-Corasick automaton, so finding every trigger that ends the buffer
+// costs one pass over the buffer however many snippets there are.
+//
+// File format, one snippet per line:
+//   trigger<TAB>expansion
+// "\n" and "\t" in the expansion stand for a newline and a tab; lines
+// starting with '#' are comments.
+class SnippetTable {
+public:
+    struct Match {
+        size_t start; // where the trigger begins in the buffer
+        const std::string *expansion;
+    };
+
+    bool load(const std::string &path);
+    void clear();
+    bool empty() const { return expansions_.empty(); }
+    size_t size() const { return expansions_.size(); }
+
+    // Snippets whose trigger is a suffix of buffer, longest trigger first.
+    std::vector<Match> matchSuffixes(const std::string &buffer) const;
+    // Expansion whose trigger is the whole buffer, if any.
+    const std::string *exactMatch(const std::string &buffer) const;
+
+private:
+    struct Node {
+        std::vector<std::pair<unsigned char, int32_t>> next; // sorted
+        int32_t fail = 0;
+        int32_t output = -1;     // snippet ending exactly here
+        int32_t outputLink = -1; // nearest node on the fail chain with one
+        uint32_t depth = 0;
+    };
+
+    int32_t child(int32_t node, unsigned char c) const;
+    int32_t step(int32_t node, unsigned char c) const;
+    void insert(const std::string &trigger, int32_t snippet);
+    void buildLinks();
+
+    std::vector<Node> nodes_;
+    std::vector<std::string> expansions_;
+};
+
+#endif // LEKHIKA_SNIPPETS_H
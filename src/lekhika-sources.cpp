@@ -0,0 +1,316 @@
+// lekhika-sources.cpp
+
+#include "lekhika-sources.h"
+#include "lekhika-normalize.h"
+#include "lekhika-utf8.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <string_view>
+
+namespace {
+
+// Score added per log-step of picks; a handful of picks outweighs a word
+// list frequency several times larger
+constexpr double kSelectionBoost = 2.0;
+
+} // namespace
+
+  //=============================================================================//
+ // SuggestionSource Implementation                                             //
+//=============================================================================//
+
+void SuggestionSource::setWeight(double weight) {
+    if (weight != weight_) {
+        weight_ = weight;
+        invalidate();
+    }
+}
+
+void SuggestionSource::invalidate() {
+    cache_.clear();
+    cacheOrder_.clear();
+}
+
+bool SuggestionSource::preload() {
+    if (loadState_ != LoadState::Pending || weight_ <= 0) {
+        return false;
+    }
+    ready();
+    return true;
+}
+
+bool SuggestionSource::ready() {
+    if (loadState_ == LoadState::Pending) {
+        loadState_ = load() ? LoadState::Loaded : LoadState::Failed;
+    }
+    return loadState_ == LoadState::Loaded && weight_ > 0;
+}
+
+double SuggestionSource::upperBound(const std::string &prefix) {
+    if (!ready()) {
+        return 0;
+    }
+    uint64_t frequency = maxFrequency(prefix);
+    // No bound given: always asked, whatever the other sources scored
+    if (frequency == UINT64_MAX) {
+        return HUGE_VAL;
+    }
+    return weight_ * std::log1p(static_cast<double>(frequency));
+}
+
+const std::vector<ScoredWord> &
+SuggestionSource::lookup(const std::string &prefix, size_t limit) {
+    if (!ready()) {
+        return empty_;
+    }
+
+    auto it = cache_.find(prefix);
+    if (it != cache_.end() &&
+        (it->second.limit >= limit || it->second.words.size() < it->second.limit)) {
+        return it->second.words;
+    }
+    if (it == cache_.end()) {
+        while (cache_.size() >= kCacheCapacity && !cacheOrder_.empty()) {
+            cache_.erase(cacheOrder_.front());
+            cacheOrder_.pop_front();
+        }
+        cacheOrder_.push_back(prefix);
+        it = cache_.emplace(prefix, CacheEntry()).first;
+    }
+
+    auto &entry = it->second;
+    entry.limit = limit;
+    entry.words.clear();
+    for (auto &raw : query(prefix, limit)) {
+        entry.words.push_back(
+            {std::move(raw.first),
+             weight_ * std::log1p(static_cast<double>(raw.second))});
+    }
+    return entry.words;
+}
+
+  //=============================================================================//
+ // WordListSource Implementation                                               //
+//=============================================================================//
+
+bool WordListSource::load() {
+    // Rebuilt unless compiled from exactly this list, so an upgrade that
+    // installs a file with an older mtime is picked up too
+    uint64_t source = fileStamp(listPath_);
+    if (!reader_.open(snapshotPath_) ||
+        (source != 0 && reader_.source() != source)) {
+        if (!compile(source) || !reader_.open(snapshotPath_)) {
+            return false;
+        }
+    }
+    indexHeads();
+    return true;
+}
+
+void WordListSource::indexHeads() {
+    headMax_.clear();
+    for (const auto &match : reader_.scanPrefix({}, reader_.size())) {
+        size_t one = lekhika::codePointPrefix(match.key, 1);
+        size_t two = lekhika::codePointPrefix(match.key, 2);
+        for (size_t length : {one, two}) {
+            auto &best = headMax_[std::string(match.key.substr(0, length))];
+            best = std::max(best, match.weight);
+        }
+    }
+}
+
+uint64_t WordListSource::maxFrequency(const std::string &prefix) {
+    // Longer prefixes share the bound of their first two characters
+    auto it =
+        headMax_.find(prefix.substr(0, lekhika::codePointPrefix(prefix, 2)));
+    return it == headMax_.end() ? 0 : it->second;
+}
+
+bool WordListSource::compile(uint64_t source) {
+    std::ifstream in(listPath_);
+    if (!in) {
+        return false;
+    }
+    std::vector<SnapshotEntry> entries;
+    std::string line;
+    while (std::getline(in, line)) {
+        auto end = line.find_first_of("\t ");
+        std::string word = line.substr(0, end);
+        if (word.empty() || word[0] == '#' || !lekhika::validateUtf8(word)) {
+            continue;
+        }
+        uint32_t frequency = 1;
+        if (end != std::string::npos) {
+            frequency = static_cast<uint32_t>(
+                std::max(1L, std::strtol(line.c_str() + end, nullptr, 10)));
+        }
+        entries.push_back({lekhika::toNfc(std::move(word)), {}, frequency});
+    }
+    return publishSnapshot(snapshotPath_, std::move(entries), source);
+}
+
+SuggestionSource::RawWords WordListSource::query(const std::string &prefix,
+                                                 size_t limit) {
+    RawWords words;
+    for (const auto &match : reader_.findPrefix(prefix, limit)) {
+        words.emplace_back(std::string(match.key), match.weight);
+    }
+    return words;
+}
+
+  //=============================================================================//
+ // SuggestionFederation Implementation                                         //
+//=============================================================================//
+
+void SuggestionFederation::addSource(std::unique_ptr<SuggestionSource> source) {
+    sources_.push_back(std::move(source));
+}
+
+bool SuggestionFederation::preloadNext() {
+    for (const auto &source : sources_) {
+        if (source->preload()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+SuggestionSource *SuggestionFederation::source(const std::string &name) const {
+    for (const auto &source : sources_) {
+        if (source->name() == name) {
+            return source.get();
+        }
+    }
+    return nullptr;
+}
+
+std::vector<ScoredWord> SuggestionFederation::lookup(
+    const std::string &prefix, size_t limit, std::vector<ScoredWord> seed,
+    const std::function<bool()> &expired, bool *complete) {
+    std::vector<ScoredWord> merged;
+    std::unordered_map<std::string, size_t> index;
+    auto add = [&merged, &index](const ScoredWord &word) {
+        auto found = index.find(word.word);
+        if (found == index.end()) {
+            index.emplace(word.word, merged.size());
+            merged.push_back(word);
+        } else if (word.score > merged[found->second].score) {
+            merged[found->second].score = word.score;
+        }
+    };
+    // Score of the limit-th best word so far, or nothing while short
+    auto threshold = [&merged, limit]() {
+        std::vector<double> scores;
+        scores.reserve(merged.size());
+        for (const auto &word : merged) {
+            scores.push_back(word.score);
+        }
+        std::nth_element(scores.begin(), scores.begin() + (limit - 1),
+                         scores.end(), std::greater<double>());
+        return scores[limit - 1];
+    };
+
+    for (const auto &word : seed) {
+        add(word);
+    }
+    if (complete) {
+        *complete = true;
+    }
+    for (const auto &source : sources_) {
+        if (limit > 0 && merged.size() >= limit &&
+            source->upperBound(prefix) <= threshold()) {
+            continue;
+        }
+        if (expired && expired()) {
+            if (complete) {
+                *complete = false;
+            }
+            break;
+        }
+        for (const auto &word : source->lookup(prefix, limit)) {
+            add(word);
+        }
+    }
+
+    std::stable_sort(merged.begin(), merged.end(),
+                     [](const ScoredWord &a, const ScoredWord &b) {
+                         return a.score > b.score;
+                     });
+    if (merged.size() > limit) {
+        merged.resize(limit);
+    }
+    return merged;
+}
+
+  //=============================================================================//
+ // SelectionBoosts Implementation                                              //
+//=============================================================================//
+
+void SelectionBoosts::clear() {
+    cache_.clear();
+    cacheOrder_.clear();
+}
+
+SelectionBoosts::Counts &SelectionBoosts::countsFor(const std::string &prefix) {
+    auto it = cache_.find(prefix);
+    if (it != cache_.end()) {
+        return it->second;
+    }
+    while (cache_.size() >= kCacheCapacity && !cacheOrder_.empty()) {
+        cache_.erase(cacheOrder_.front());
+        cacheOrder_.pop_front();
+    }
+    cacheOrder_.push_back(prefix);
+    return cache_[prefix] = loader_ ? loader_(prefix) : Counts();
+}
+
+void SelectionBoosts::add(const std::string &prefix, const std::string &word,
+                          int64_t increment) {
+    auto &counts = countsFor(prefix);
+    for (auto it = counts.begin(); it != counts.end(); ++it) {
+        if (it->first == word) {
+            // Undo takes a pick back; a word picked no more is not boosted
+            it->second += increment;
+            if (it->second <= 0) {
+                counts.erase(it);
+            }
+            return;
+        }
+    }
+    if (increment > 0) {
+        counts.emplace_back(word, increment);
+    }
+}
+
+void SelectionBoosts::apply(const std::string &prefix,
+                            std::vector<ScoredWord> &words, size_t limit) {
+    const auto &counts = countsFor(prefix);
+    if (!counts.empty()) {
+        // A picked word the sources no longer rank starts from the bottom
+        double floor = words.empty() ? 0 : words.back().score;
+        for (const auto &count : counts) {
+            double boost =
+                kSelectionBoost * std::log1p(static_cast<double>(count.second));
+            auto it = std::find_if(words.begin(), words.end(),
+                                   [&count](const ScoredWord &w) {
+                                       return w.word == count.first;
+                                   });
+            if (it != words.end()) {
+                it->score += boost;
+            } else {
+                words.push_back({count.first, floor + boost});
+            }
+        }
+        std::stable_sort(words.begin(), words.end(),
+                         [](const ScoredWord &a, const ScoredWord &b) {
+                             return a.score > b.score;
+                         });
+    }
+    if (words.size() > limit) {
+        words.resize(limit);
+    }
+}
@@ -0,0 +1,193 @@
+#ifndef LEKHIKA_SOURCES_H
+#define LEKHIKA_SOURCES_H
+
+#include "lekhika-snapshot.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct ScoredWord {
+    std::string word;
+    double score = 0;
+};
+
+/* ----------  one dictionary taking part in suggestions  ---------- */
+// A source is loaded on its first lookup and keeps its own cache of recent
+// prefixes, so sources can be added without slowing down the others.
+class SuggestionSource {
+public:
+    using RawWords = std::vector<std::pair<std::string, uint64_t>>;
+
+    SuggestionSource(std::string name, double weight)
+        : name_(std::move(name)), weight_(weight) {}
+    virtual ~SuggestionSource() = default;
+
+    const std::string &name() const { return name_; }
+    double weight() const { return weight_; }
+    void setWeight(double weight);
+
+    // Best-first words for prefix, scored as weight * log(1 + frequency).
+    const std::vector<ScoredWord> &lookup(const std::string &prefix,
+                                          size_t limit);
+    // No word this source returns for prefix can score higher; infinite
+    // when the source gives no bound.
+    double upperBound(const std::string &prefix);
+    void invalidate();
+    // Loads the source now instead of on its first lookup. Returns false
+    // if there was nothing to load.
+    bool preload();
+
+protected:
+    // Called once before the first query; a source that fails to load
+    // simply contributes nothing.
+    virtual bool load() { return true; }
+    // Most frequent words starting with prefix, best first.
+    virtual RawWords query(const std::string &prefix, size_t limit) = 0;
+    // Highest frequency among words starting with prefix, or any larger
+    // value. UINT64_MAX, the default, means no bound: the source is never
+    // skipped.
+    virtual uint64_t maxFrequency(const std::string &prefix) {
+        (void)prefix;
+        return UINT64_MAX;
+    }
+
+private:
+    bool ready();
+
+    struct CacheEntry {
+        size_t limit = 0;
+        std::vector<ScoredWord> words;
+    };
+    static constexpr size_t kCacheCapacity = 64;
+
+    std::string name_;
+    double weight_;
+    enum class LoadState { Pending, Loaded, Failed } loadState_ =
+        LoadState::Pending;
+    std::unordered_map<std::string, CacheEntry> cache_;
+    std::deque<std::string> cacheOrder_;
+    std::vector<ScoredWord> empty_;
+};
+
+/* ----------  word list compiled to a snapshot on first use  ---------- */
+// Reads "word" or "word<TAB>frequency" lines. The compiled snapshot is
+// rebuilt only when the list is newer than it.
+class WordListSource : public SuggestionSource {
+public:
+    WordListSource(std::string name, double weight, std::string listPath,
+                   std::string snapshotPath)
+        : SuggestionSource(std::move(name), weight),
+          listPath_(std::move(listPath)),
+          snapshotPath_(std::move(snapshotPath)) {}
+
+protected:
+    bool load() override;
+    RawWords query(const std::string &prefix, size_t limit) override;
+    uint64_t maxFrequency(const std::string &prefix) override;
+
+private:
+    bool compile(uint64_t source);
+    void indexHeads();
+
+    std::string listPath_;
+    std::string snapshotPath_;
+    SnapshotReader reader_;
+    // Highest frequency per first one and first two characters of a word
+    std::unordered_map<std::string, uint32_t> headMax_;
+};
+
+/* ----------  source answered by a callback  ---------- */
+class FunctionSource : public SuggestionSource {
+public:
+    using Query = std::function<RawWords(const std::string &, size_t)>;
+    // Highest frequency query can return for a prefix; see maxFrequency
+    using Bound = std::function<uint64_t(const std::string &)>;
+
+    FunctionSource(std::string name, double weight, Query query,
+                   Bound bound = {})
+        : SuggestionSource(std::move(name), weight), query_(std::move(query)),
+          bound_(std::move(bound)) {}
+
+protected:
+    RawWords query(const std::string &prefix, size_t limit) override {
+        return query_(prefix, limit);
+    }
+    uint64_t maxFrequency(const std::string &prefix) override {
+        return bound_ ? bound_(prefix) : SuggestionSource::maxFrequency(prefix);
+    }
+
+private:
+    Query query_;
+    Bound bound_;
+};
+
+/* ----------  merged view over all sources  ---------- */
+// Sources are tiers, asked in the order they were added, which should be
+// cheapest first. A tier whose upper bound cannot beat the k-th best word
+// found so far is skipped, so for common prefixes the large lists are
+// never touched.
+class SuggestionFederation {
+public:
+    void addSource(std::unique_ptr<SuggestionSource> source);
+    SuggestionSource *source(const std::string &name) const;
+    const std::vector<std::unique_ptr<SuggestionSource>> &sources() const {
+        return sources_;
+    }
+    void clear() { sources_.clear(); }
+    // Loads the next source still waiting for its first lookup; false once
+    // none is left. Lets the lists load one at a time between keys.
+    bool preloadNext();
+
+    // Best limit words over seed and every tier that can still contribute.
+    // A word offered by several tiers keeps its best score. Once expired()
+    // returns true the remaining tiers are left out and *complete is set
+    // to false.
+    std::vector<ScoredWord> lookup(const std::string &prefix, size_t limit,
+                                   std::vector<ScoredWord> seed = {},
+                                   const std::function<bool()> &expired = {},
+                                   bool *complete = nullptr);
+
+private:
+    std::vector<std::unique_ptr<SuggestionSource>> sources_;
+};
+
+/* ----------  per-prefix boosts learned from picked candidates  ---------- */
+// Counts how often a word was picked from the candidates of a prefix and
+// lifts it for that prefix, so a word picked again and again ends up
+// first. Counts for a prefix are read through the loader on first use.
+class SelectionBoosts {
+public:
+    using Counts = std::vector<std::pair<std::string, int64_t>>;
+    using Loader = std::function<Counts(const std::string &prefix)>;
+
+    void setLoader(Loader loader) { loader_ = std::move(loader); }
+    void add(const std::string &prefix, const std::string &word,
+             int64_t increment);
+    // Re-ranks the best-first words for prefix and trims them to limit.
+    // Boosted words the sources did not return are added.
+    void apply(const std::string &prefix, std::vector<ScoredWord> &words,
+               size_t limit);
+    // Whether any word was picked for prefix.
+    bool boosted(const std::string &prefix) {
+        return !countsFor(prefix).empty();
+    }
+    void clear();
+
+private:
+    static constexpr size_t kCacheCapacity = 256;
+
+    Counts &countsFor(const std::string &prefix);
+
+    Loader loader_;
+    std::unordered_map<std::string, Counts> cache_;
+    std::deque<std::string> cacheOrder_;
+};
+
+#endif // LEKHIKA_SOURCES_H
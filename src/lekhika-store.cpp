@@ -0,0 +1,318 @@
+// lekhika-store.cpp
+
+#include "lekhika-store.h"
+#include "lekhika-utf8.h"
+
+#include <sqlite3.h>
+
+#include <fcitx-utils/log.h>
+
+namespace {
+
+// Readers rarely hold the database for long in WAL mode; never stall a
+// keystroke waiting for one.
+constexpr int kBusyTimeoutMs = 20;
+// Virtual machine steps between two looks at the clock
+constexpr int kProgressSteps = 1000;
+// The prefix index files every word under its first one and first two
+// characters; longer prefixes are filtered within their two-character head
+constexpr size_t kHeadLength = 2;
+
+// Smallest string greater than every string starting with prefix, so a
+// prefix match becomes a range scan over the word index.
+std::string prefixUpperBound(std::string prefix) {
+    while (!prefix.empty()) {
+        auto last = static_cast<unsigned char>(prefix.back());
+        if (last < 0xFF) {
+            prefix.back() = static_cast<char>(last + 1);
+            return prefix;
+        }
+        prefix.pop_back();
+    }
+    return std::string(1, '\xFF');
+}
+
+} // namespace
+
+WordStore::~WordStore() { close(); }
+
+void WordStore::close() {
+    for (auto **stmt : {&findStmt_, &topStmt_, &updateStmt_, &insertStmt_,
+                        &deleteStmt_, &unindexStmt_, &indexStmt_,
+                        &findSelectionStmt_, &addSelectionStmt_,
+                        &removeSelectionStmt_}) {
+        sqlite3_finalize(*stmt);
+        *stmt = nullptr;
+    }
+    if (db_) {
+        sqlite3_close(db_);
+        db_ = nullptr;
+    }
+    indexed_ = false;
+}
+
+bool WordStore::exec(const char *sql) {
+    char *error = nullptr;
+    if (sqlite3_exec(db_, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+        FCITX_WARN() << "Lekhika: " << sql << ": " << (error ? error : "");
+        sqlite3_free(error);
+        return false;
+    }
+    return true;
+}
+
+sqlite3_stmt *WordStore::prepare(const char *sql) {
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v3(db_, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt,
+                           nullptr) != SQLITE_OK) {
+        FCITX_WARN() << "Lekhika: " << sqlite3_errmsg(db_);
+        return nullptr;
+    }
+    return stmt;
+}
+
+bool WordStore::open(const std::string &path, const std::string &ownPath) {
+    close();
+    if (sqlite3_open_v2(path.c_str(), &db_,
+                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                            SQLITE_OPEN_NOMUTEX,
+                        nullptr) != SQLITE_OK) {
+        FCITX_WARN() << "Lekhika: cannot open " << path;
+        close();
+        return false;
+    }
+    sqlite3_busy_timeout(db_, kBusyTimeoutMs);
+
+    // WAL keeps readers and the single writer out of each other's way;
+    // NORMAL sync is durable across application crashes, which is all a
+    // learned-word count needs.
+    exec("PRAGMA journal_mode=WAL");
+    exec("PRAGMA synchronous=NORMAL");
+    exec("PRAGMA mmap_size=268435456");
+    exec("PRAGMA temp_store=MEMORY");
+
+    sqlite3_stmt *attach = prepare("ATTACH DATABASE ?1 AS addon");
+    if (attach) {
+        sqlite3_bind_text(attach, 1, ownPath.data(),
+                          static_cast<int>(ownPath.size()), SQLITE_STATIC);
+    }
+    bool attached = attach && sqlite3_step(attach) == SQLITE_DONE;
+    sqlite3_finalize(attach);
+    if (!attached) {
+        FCITX_WARN() << "Lekhika: cannot open " << ownPath;
+    }
+    bool ok =
+        attached && exec("PRAGMA addon.journal_mode=WAL") &&
+        exec("PRAGMA addon.synchronous=NORMAL") &&
+        // Every word under each head, so the words for a prefix can be read
+        // best first from the frequency index without sorting the range
+        exec("CREATE TABLE IF NOT EXISTS addon.word_heads ("
+             "head TEXT NOT NULL, word TEXT NOT NULL, "
+             "frequency INTEGER NOT NULL, PRIMARY KEY(head, word)) "
+             "WITHOUT ROWID") &&
+        exec("CREATE INDEX IF NOT EXISTS addon.idx_word_heads_frequency "
+             "ON word_heads(head, frequency DESC)") &&
+        exec("CREATE TABLE IF NOT EXISTS addon.selection_boosts ("
+             "prefix TEXT NOT NULL, word TEXT NOT NULL, "
+             "count INTEGER NOT NULL DEFAULT 1, PRIMARY KEY(prefix, word))");
+    if (ok) {
+        // INDEXED BY: the primary key also serves the word range, but only
+        // unsorted, which would read the whole head before the first row
+        findStmt_ = prepare("SELECT word, frequency FROM addon.word_heads "
+                            "INDEXED BY idx_word_heads_frequency "
+                            "WHERE head = ?1 AND word >= ?2 AND word < ?3 "
+                            "ORDER BY frequency DESC LIMIT ?4");
+        topStmt_ = prepare("SELECT word, frequency FROM main.words "
+                           "WHERE frequency > 0 "
+                           "ORDER BY frequency DESC LIMIT ?1");
+        updateStmt_ = prepare(
+            "UPDATE main.words SET frequency = frequency + ?2 WHERE word = ?1");
+        insertStmt_ =
+            prepare("INSERT INTO main.words(word, frequency) VALUES(?1, ?2)");
+        deleteStmt_ = prepare(
+            "DELETE FROM main.words WHERE word = ?1 AND frequency <= 0");
+        unindexStmt_ = prepare(
+            "DELETE FROM addon.word_heads "
+            "WHERE head IN (substr(?1, 1, 1), substr(?1, 1, 2)) AND word = ?1");
+        indexStmt_ = prepare(
+            "INSERT INTO addon.word_heads(head, word, frequency) "
+            "SELECT substr(word, 1, 1), word, frequency FROM main.words "
+            "WHERE word = ?1 AND frequency > 0 "
+            "UNION SELECT substr(word, 1, 2), word, frequency FROM main.words "
+            "WHERE word = ?1 AND frequency > 0");
+        findSelectionStmt_ = prepare("SELECT word, count "
+                                     "FROM addon.selection_boosts "
+                                     "WHERE prefix = ?1 "
+                                     "ORDER BY count DESC LIMIT ?2");
+        addSelectionStmt_ = prepare(
+            "INSERT INTO addon.selection_boosts(prefix, word, count) "
+            "VALUES(?1, ?2, ?3) "
+            "ON CONFLICT(prefix, word) DO UPDATE SET count = count + ?3");
+        removeSelectionStmt_ = prepare(
+            "DELETE FROM addon.selection_boosts "
+            "WHERE prefix = ?1 AND word = ?2 AND count <= 0");
+    }
+    if (!ok || !findStmt_ || !topStmt_ || !updateStmt_ || !insertStmt_ ||
+        !deleteStmt_ || !unindexStmt_ || !indexStmt_ || !findSelectionStmt_ ||
+        !addSelectionStmt_ || !removeSelectionStmt_) {
+        close();
+        return false;
+    }
+    // reindex() marks the index as built
+    sqlite3_stmt *version = prepare("PRAGMA addon.user_version");
+    if (version && sqlite3_step(version) == SQLITE_ROW) {
+        indexed_ = sqlite3_column_int(version, 0) > 0;
+    }
+    sqlite3_finalize(version);
+    return true;
+}
+
+bool WordStore::reindex() {
+    if (!db_) {
+        return false;
+    }
+    bool ok =
+        exec("BEGIN IMMEDIATE") &&
+        exec("DELETE FROM addon.word_heads") &&
+        exec("INSERT INTO addon.word_heads(head, word, frequency) "
+             "SELECT substr(word, 1, 1), word, frequency FROM main.words "
+             "WHERE frequency > 0 AND word <> '' "
+             "UNION SELECT substr(word, 1, 2), word, frequency FROM main.words "
+             "WHERE frequency > 0 AND word <> ''") &&
+        exec("PRAGMA addon.user_version = 1") && exec("COMMIT");
+    if (!ok) {
+        exec("ROLLBACK");
+        return false;
+    }
+    indexed_ = true;
+    return true;
+}
+
+int WordStore::onProgress(void *store) {
+    auto *self = static_cast<WordStore *>(store);
+    if (self->expired_ && self->expired_()) {
+        self->interrupted_ = true;
+        return 1;
+    }
+    return 0;
+}
+
+void WordStore::setInterrupt(std::function<bool()> expired) {
+    expired_ = std::move(expired);
+    if (db_) {
+        sqlite3_progress_handler(db_, expired_ ? kProgressSteps : 0,
+                                 expired_ ? &WordStore::onProgress : nullptr,
+                                 this);
+    }
+}
+
+std::vector<WordStore::Word> WordStore::readWords(sqlite3_stmt *stmt) {
+    std::vector<Word> words;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const auto *text =
+            reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+        if (text) {
+            words.push_back({std::string(text, sqlite3_column_bytes(stmt, 0)),
+                             sqlite3_column_int64(stmt, 1)});
+        }
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return words;
+}
+
+std::vector<WordStore::Word> WordStore::findPrefix(const std::string &prefix,
+                                                   int limit) {
+    interrupted_ = false;
+    if (!findStmt_) {
+        return {};
+    }
+    if (prefix.empty()) {
+        return topWords(limit);
+    }
+    std::string head =
+        prefix.substr(0, lekhika::codePointPrefix(prefix, kHeadLength));
+    std::string upper = prefixUpperBound(prefix);
+    sqlite3_bind_text(findStmt_, 1, head.data(), static_cast<int>(head.size()),
+                      SQLITE_STATIC);
+    sqlite3_bind_text(findStmt_, 2, prefix.data(),
+                      static_cast<int>(prefix.size()), SQLITE_STATIC);
+    sqlite3_bind_text(findStmt_, 3, upper.data(), static_cast<int>(upper.size()),
+                      SQLITE_STATIC);
+    sqlite3_bind_int(findStmt_, 4, limit);
+    return readWords(findStmt_);
+}
+
+std::vector<WordStore::Word> WordStore::topWords(int limit) {
+    interrupted_ = false;
+    if (!topStmt_) {
+        return {};
+    }
+    sqlite3_bind_int(topStmt_, 1, limit);
+    return readWords(topStmt_);
+}
+
+bool WordStore::stepWord(sqlite3_stmt *stmt, const std::string &word) {
+    sqlite3_bind_text(stmt, 1, word.data(), static_cast<int>(word.size()),
+                      SQLITE_STATIC);
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_reset(stmt);
+    return ok;
+}
+
+bool WordStore::addWord(const std::string &word, int64_t increment) {
+    if (!updateStmt_ || word.empty()) {
+        return false;
+    }
+    // UPDATE-then-INSERT works whatever constraints an older database
+    // was created with.
+    sqlite3_bind_text(updateStmt_, 1, word.data(), static_cast<int>(word.size()),
+                      SQLITE_STATIC);
+    sqlite3_bind_int64(updateStmt_, 2, increment);
+    bool ok = sqlite3_step(updateStmt_) == SQLITE_DONE;
+    sqlite3_reset(updateStmt_);
+    if (ok && increment <= 0) {
+        // Forgetting a word the store does not have is a no-op
+        ok = stepWord(deleteStmt_, word);
+    } else if (ok && sqlite3_changes(db_) == 0) {
+        sqlite3_bind_int64(insertStmt_, 2, increment);
+        ok = stepWord(insertStmt_, word);
+    }
+    // The index follows the word's new frequency, or loses it
+    return ok && stepWord(unindexStmt_, word) && stepWord(indexStmt_, word);
+}
+
+std::vector<WordStore::Word>
+WordStore::findSelections(const std::string &prefix, int limit) {
+    if (!findSelectionStmt_) {
+        return {};
+    }
+    sqlite3_bind_text(findSelectionStmt_, 1, prefix.data(),
+                      static_cast<int>(prefix.size()), SQLITE_STATIC);
+    sqlite3_bind_int(findSelectionStmt_, 2, limit);
+    return readWords(findSelectionStmt_);
+}
+
+bool WordStore::addSelection(const std::string &prefix, const std::string &word,
+                             int64_t increment) {
+    if (!addSelectionStmt_ || prefix.empty() || word.empty()) {
+        return false;
+    }
+    sqlite3_bind_text(addSelectionStmt_, 1, prefix.data(),
+                      static_cast<int>(prefix.size()), SQLITE_STATIC);
+    sqlite3_bind_text(addSelectionStmt_, 2, word.data(),
+                      static_cast<int>(word.size()), SQLITE_STATIC);
+    sqlite3_bind_int64(addSelectionStmt_, 3, increment);
+    bool ok = sqlite3_step(addSelectionStmt_) == SQLITE_DONE;
+    sqlite3_reset(addSelectionStmt_);
+    if (ok && increment <= 0) {
+        // A pick taken back; one that was never stored leaves nothing
+        sqlite3_bind_text(removeSelectionStmt_, 1, prefix.data(),
+                          static_cast<int>(prefix.size()), SQLITE_STATIC);
+        sqlite3_bind_text(removeSelectionStmt_, 2, word.data(),
+                          static_cast<int>(word.size()), SQLITE_STATIC);
+        ok = sqlite3_step(removeSelectionStmt_) == SQLITE_DONE;
+        sqlite3_reset(removeSelectionStmt_);
+    }
+    return ok;
+}
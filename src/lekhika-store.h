@@ -0,0 +1,88 @@
+#ifndef LEKHIKA_STORE_H
+#define LEKHIKA_STORE_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+/* ----------  addon-side word store  ---------- */
+// Opens the lekhika word database in WAL mode so lekhika-trainer can keep
+// reading while the addon learns, and keeps the statements used on every
+// keystroke prepared for the lifetime of the connection. The schema of
+// that database belongs to liblekhika; what only the addon keeps, the
+// prefix index and the candidate picks, lives in a database of its own.
+class WordStore {
+public:
+    struct Word {
+        std::string text;
+        int64_t frequency = 0;
+    };
+
+    WordStore() = default;
+    ~WordStore();
+    WordStore(const WordStore &) = delete;
+    WordStore &operator=(const WordStore &) = delete;
+
+    // path is liblekhika's word database, ownPath the addon's own.
+    bool open(const std::string &path, const std::string &ownPath);
+    void close();
+    bool isOpen() const { return db_ != nullptr; }
+
+    // Most frequent words starting with prefix, best first. Rows come out
+    // of the prefix index already in frequency order.
+    std::vector<Word> findPrefix(const std::string &prefix, int limit);
+    // Most frequent words of the whole database; sorts every row, so it is
+    // kept off the keystroke path.
+    std::vector<Word> topWords(int limit);
+    // Adds increment to the word's frequency, inserting it if needed. A
+    // negative increment never inserts, and a word it takes to zero is
+    // deleted.
+    bool addWord(const std::string &word, int64_t increment = 1);
+
+    // Whether the prefix index was ever built; addWord keeps it current,
+    // but words other programs write only reach it through reindex().
+    bool indexed() const { return indexed_; }
+    bool reindex();
+
+    // Queries stop early once expired() returns true; an empty function
+    // lets them run to the end. A prefix query cut short keeps the rows it
+    // found, best first.
+    void setInterrupt(std::function<bool()> expired);
+    // Whether the last query was cut short by the interrupt.
+    bool interrupted() const { return interrupted_; }
+
+    // How often each word was picked from the candidates for prefix. A
+    // negative increment takes picks back and deletes a count it empties.
+    std::vector<Word> findSelections(const std::string &prefix, int limit);
+    bool addSelection(const std::string &prefix, const std::string &word,
+                      int64_t increment);
+
+private:
+    bool exec(const char *sql);
+    sqlite3_stmt *prepare(const char *sql);
+    static int onProgress(void *store);
+
+    std::vector<Word> readWords(sqlite3_stmt *stmt);
+    bool stepWord(sqlite3_stmt *stmt, const std::string &word);
+
+    sqlite3 *db_ = nullptr;
+    sqlite3_stmt *findStmt_ = nullptr;
+    sqlite3_stmt *topStmt_ = nullptr;
+    sqlite3_stmt *updateStmt_ = nullptr;
+    sqlite3_stmt *insertStmt_ = nullptr;
+    sqlite3_stmt *deleteStmt_ = nullptr;
+    sqlite3_stmt *unindexStmt_ = nullptr;
+    sqlite3_stmt *indexStmt_ = nullptr;
+    sqlite3_stmt *findSelectionStmt_ = nullptr;
+    sqlite3_stmt *addSelectionStmt_ = nullptr;
+    sqlite3_stmt *removeSelectionStmt_ = nullptr;
+    std::function<bool()> expired_;
+    bool interrupted_ = false;
+    bool indexed_ = false;
+};
+
+#endif // LEKHIKA_STORE_H
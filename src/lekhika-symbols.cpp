@@ -0,0 +1,86 @@
+// lekhika-symbols.cpp
+
+#include "lekhika-symbols.h"
+#include "lekhika-utf8.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+bool SymbolIndex::ensureLoaded() {
+    if (attempted_) {
+        return reader_.isOpen();
+    }
+    attempted_ = true;
+    // Rebuilt unless compiled from exactly this table, so an upgrade that
+    // installs a file with an older mtime is picked up too
+    uint64_t source = fileStamp(tablePath_);
+    if (reader_.open(snapshotPath_) &&
+        (source == 0 || reader_.source() == source)) {
+        return true;
+    }
+    return compile(source) && reader_.open(snapshotPath_);
+}
+
+bool SymbolIndex::compile(uint64_t source) {
+    std::ifstream in(tablePath_);
+    if (!in) {
+        return false;
+    }
+    std::vector<std::pair<std::string, std::string>> lines;
+    std::string line;
+    while (std::getline(in, line)) {
+        auto tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == std::string::npos ||
+            !lekhika::validateUtf8(line)) {
+            continue;
+        }
+        lines.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+    }
+
+    std::vector<SnapshotEntry> entries;
+    auto weight = static_cast<uint32_t>(lines.size());
+    for (const auto &item : lines) {
+        std::istringstream keywords(item.second);
+        std::string keyword;
+        while (keywords >> keyword) {
+            entries.push_back({keyword + '\t' + item.first, item.first, weight});
+        }
+        --weight;
+    }
+    return publishSnapshot(snapshotPath_, std::move(entries), source);
+}
+
+std::vector<std::string>
+SymbolIndex::search(const std::vector<std::string> &queries, size_t limit) {
+    std::vector<std::string> result;
+    if (!ensureLoaded()) {
+        return result;
+    }
+
+    // Keys are "keyword<TAB>symbol" so one symbol may carry many keywords;
+    // ask for extra matches to make up for duplicates.
+    std::vector<SnapshotReader::Match> matches;
+    for (const auto &query : queries) {
+        if (query.empty()) {
+            continue;
+        }
+        auto found = reader_.findPrefix(query, limit * 4);
+        matches.insert(matches.end(), found.begin(), found.end());
+    }
+    std::stable_sort(matches.begin(), matches.end(),
+                     [](const SnapshotReader::Match &a,
+                        const SnapshotReader::Match &b) {
+                         return a.weight > b.weight;
+                     });
+    for (const auto &match : matches) {
+        std::string symbol(match.value);
+        if (std::find(result.begin(), result.end(), symbol) == result.end()) {
+            result.push_back(std::move(symbol));
+            if (result.size() >= limit) {
+                break;
+            }
+        }
+    }
+    return result;
+}
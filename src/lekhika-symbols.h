@@ -0,0 +1,40 @@
+#ifndef LEKHIKA_SYMBOLS_H
+#define LEKHIKA_SYMBOLS_H
+
+#include "lekhika-snapshot.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* ----------  searchable symbol and emoji table  ---------- */
+// The bundled table lists one symbol per line followed by its Roman and
+// Nepali keywords:
+//   symbol<TAB>keyword keyword ...
+// On first search it is compiled into a keyword snapshot and mapped, so a
+// search is a binary search over keywords however large the table grows.
+// Lines near the top of the table rank first.
+class SymbolIndex {
+public:
+    SymbolIndex() = default;
+    SymbolIndex(std::string tablePath, std::string snapshotPath)
+        : tablePath_(std::move(tablePath)),
+          snapshotPath_(std::move(snapshotPath)) {}
+
+    // Symbols with a keyword starting with any of the queries, best first.
+    std::vector<std::string> search(const std::vector<std::string> &queries,
+                                    size_t limit);
+
+private:
+    bool ensureLoaded();
+    bool compile(uint64_t source);
+
+    std::string tablePath_;
+    std::string snapshotPath_;
+    SnapshotReader reader_;
+    bool attempted_ = false;
+};
+
+#endif // LEKHIKA_SYMBOLS_H
@@ -0,0 +1,356 @@
+// lekhika-utf8.cpp
+
+#include "lekhika-utf8.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LEKHIKA_HAVE_X86_SIMD 1
+#endif
+
+namespace lekhika {
+
+namespace {
+
+  //=============================================================================//
+ // Scalar implementation                                                       //
+//=============================================================================//
+
+// Length of the well-formed sequence starting at p, or 0 if it is not one.
+size_t sequenceLength(const uint8_t *p, const uint8_t *end) {
+    uint8_t b0 = p[0];
+    if (b0 < 0x80) {
+        return 1;
+    }
+    auto cont = [end](const uint8_t *q) { return q < end && (*q & 0xC0) == 0x80; };
+    if (b0 >= 0xC2 && b0 <= 0xDF) {
+        return cont(p + 1) ? 2 : 0;
+    }
+    if (b0 >= 0xE0 && b0 <= 0xEF) {
+        if (!cont(p + 1) || !cont(p + 2)) {
+            return 0;
+        }
+        if ((b0 == 0xE0 && p[1] < 0xA0) || (b0 == 0xED && p[1] > 0x9F)) {
+            return 0; // overlong or surrogate
+        }
+        return 3;
+    }
+    if (b0 >= 0xF0 && b0 <= 0xF4) {
+        if (!cont(p + 1) || !cont(p + 2) || !cont(p + 3)) {
+            return 0;
+        }
+        if ((b0 == 0xF0 && p[1] < 0x90) || (b0 == 0xF4 && p[1] > 0x8F)) {
+            return 0; // overlong or above U+10FFFF
+        }
+        return 4;
+    }
+    return 0;
+}
+
+bool validateScalarRange(const uint8_t *p, const uint8_t *end) {
+    while (p < end) {
+        size_t n = sequenceLength(p, end);
+        if (!n) {
+            return false;
+        }
+        p += n;
+    }
+    return true;
+}
+
+bool validateScalar(const char *data, size_t length) {
+    const auto *p = reinterpret_cast<const uint8_t *>(data);
+    return validateScalarRange(p, p + length);
+}
+
+unsigned classifyScalarRange(const uint8_t *p, const uint8_t *end) {
+    unsigned flags = 0;
+    while (p < end) {
+        uint8_t b0 = *p;
+        if (b0 < 0x80) {
+            flags |= ScriptAscii;
+            ++p;
+        } else if (b0 == 0xE0 && end - p >= 3 && (p[1] == 0xA4 || p[1] == 0xA5)) {
+            flags |= ScriptDevanagari;
+            p += 3;
+        } else if (b0 == 0xE2 && end - p >= 3 && p[1] == 0x80 &&
+                   (p[2] == 0x8C || p[2] == 0x8D)) {
+            flags |= ScriptDevanagari; // ZWNJ / ZWJ shape conjuncts
+            p += 3;
+        } else {
+            flags |= ScriptOther;
+            ++p;
+            while (p < end && (*p & 0xC0) == 0x80) {
+                ++p;
+            }
+        }
+    }
+    return flags;
+}
+
+#ifdef LEKHIKA_HAVE_X86_SIMD
+
+  //=============================================================================//
+ // SSE2 implementation                                                         //
+//=============================================================================//
+
+// Skips ASCII sixteen bytes at a time and checks the rest one sequence at a
+// time until the next ASCII byte.
+__attribute__((target("sse2"))) bool validateSse2(const char *data,
+                                                  size_t length) {
+    const auto *p = reinterpret_cast<const uint8_t *>(data);
+    const uint8_t *end = p + length;
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int mask = _mm_movemask_epi8(chunk);
+        if (!mask) {
+            p += 16;
+            continue;
+        }
+        p += __builtin_ctz(static_cast<unsigned>(mask));
+        while (p < end && *p >= 0x80) {
+            size_t n = sequenceLength(p, end);
+            if (!n) {
+                return false;
+            }
+            p += n;
+        }
+    }
+    return validateScalarRange(p, end);
+}
+
+// Devanagari text is a run of E0 A4|A5 xx triples. A block passes when every
+// lead byte is E0 and every byte after an E0 is A4 or A5; anything else is
+// left to the scalar classifier.
+__attribute__((target("sse2"))) unsigned classifySse2(const char *data,
+                                                      size_t length) {
+    const auto *begin = reinterpret_cast<const uint8_t *>(data);
+    const uint8_t *p = begin;
+    const uint8_t *end = p + length;
+    const __m128i leadBits = _mm_set1_epi8(static_cast<char>(0xC0));
+    const __m128i e0 = _mm_set1_epi8(static_cast<char>(0xE0));
+    const __m128i a4 = _mm_set1_epi8(static_cast<char>(0xA4));
+    const __m128i a5 = _mm_set1_epi8(static_cast<char>(0xA5));
+    unsigned flags = 0;
+    __m128i prev = _mm_setzero_si128();
+
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int nonAscii = _mm_movemask_epi8(chunk);
+        if (nonAscii != 0xFFFF) {
+            flags |= ScriptAscii;
+        }
+        if (nonAscii) {
+            __m128i prev1 =
+                _mm_or_si128(_mm_slli_si128(chunk, 1), _mm_srli_si128(prev, 15));
+            __m128i isLead =
+                _mm_cmpeq_epi8(_mm_and_si128(chunk, leadBits), leadBits);
+            __m128i badLead = _mm_andnot_si128(_mm_cmpeq_epi8(chunk, e0), isLead);
+            __m128i afterE0 = _mm_cmpeq_epi8(prev1, e0);
+            __m128i blockByte =
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, a4), _mm_cmpeq_epi8(chunk, a5));
+            __m128i badBlock = _mm_andnot_si128(blockByte, afterE0);
+            if (_mm_movemask_epi8(_mm_or_si128(badLead, badBlock))) {
+                break;
+            }
+            flags |= ScriptDevanagari;
+        }
+        prev = chunk;
+        p += 16;
+    }
+    // Resume the scalar walk at the start of the character straddling p
+    while (p > begin && p < end && (*p & 0xC0) == 0x80) {
+        --p;
+    }
+    return flags | classifyScalarRange(p, end);
+}
+
+  //=============================================================================//
+ // AVX2 implementation                                                         //
+//=============================================================================//
+
+// Lookup-table validator after Keiser & Lemire, "Validating UTF-8 In Less
+// Than One Instruction Per Byte". Each byte is checked against the one to
+// three bytes before it using three nibble-indexed tables.
+constexpr uint8_t kTooShort = 1 << 0;
+constexpr uint8_t kTooLong = 1 << 1;
+constexpr uint8_t kOverlong3 = 1 << 2;
+constexpr uint8_t kTooLarge = 1 << 3;
+constexpr uint8_t kSurrogate = 1 << 4;
+constexpr uint8_t kOverlong2 = 1 << 5;
+constexpr uint8_t kTooLarge1000 = 1 << 6;
+constexpr uint8_t kOverlong4 = 1 << 6;
+constexpr uint8_t kTwoConts = 1 << 7;
+constexpr uint8_t kCarry = kTooShort | kTooLong | kTwoConts;
+
+alignas(16) const uint8_t kByte1High[16] = {
+    kTooLong, kTooLong, kTooLong, kTooLong,
+    kTooLong, kTooLong, kTooLong, kTooLong,
+    kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+    kTooShort | kOverlong2,
+    kTooShort,
+    kTooShort | kOverlong3 | kSurrogate,
+    kTooShort | kTooLarge | kTooLarge1000 | kOverlong4,
+};
+
+alignas(16) const uint8_t kByte1Low[16] = {
+    kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+    kCarry | kOverlong2,
+    kCarry,
+    kCarry,
+    kCarry | kTooLarge,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+};
+
+alignas(16) const uint8_t kByte2High[16] = {
+    kTooShort, kTooShort, kTooShort, kTooShort,
+    kTooShort, kTooShort, kTooShort, kTooShort,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooShort, kTooShort, kTooShort, kTooShort,
+};
+
+__attribute__((target("avx2"))) inline __m256i lookup16(__m256i index,
+                                                        const uint8_t *table) {
+    __m256i t = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i *>(table)));
+    return _mm256_shuffle_epi8(t, index);
+}
+
+__attribute__((target("avx2"))) inline __m256i highNibble(__m256i v) {
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+// Bytes of input shifted right by N, pulling the tail of prev in front.
+template <int N>
+__attribute__((target("avx2"))) inline __m256i previous(__m256i input,
+                                                        __m256i prev) {
+    return _mm256_alignr_epi8(
+        input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+}
+
+__attribute__((target("avx2"))) inline __m256i checkBlock(__m256i input,
+                                                          __m256i prev) {
+    __m256i prev1 = previous<1>(input, prev);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(lookup16(highNibble(prev1), kByte1High),
+                         lookup16(_mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)),
+                                  kByte1Low)),
+        lookup16(highNibble(input), kByte2High));
+
+    // Third and fourth bytes of a sequence must be continuations
+    __m256i third = _mm256_subs_epu8(previous<2>(input, prev),
+                                     _mm256_set1_epi8(0xE0 - 0x80));
+    __m256i fourth = _mm256_subs_epu8(previous<3>(input, prev),
+                                      _mm256_set1_epi8(0xF0 - 0x80));
+    __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                      _mm256_set1_epi8(static_cast<char>(0x80)));
+    return _mm256_xor_si256(must23, special);
+}
+
+// Non-zero where the block ends inside a multi-byte sequence.
+__attribute__((target("avx2"))) inline __m256i incompleteTail(__m256i input) {
+    const __m256i maxValue = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1),
+        static_cast<char>(0xC0 - 1));
+    return _mm256_subs_epu8(input, maxValue);
+}
+
+__attribute__((target("avx2"))) bool validateAvx2(const char *data,
+                                                  size_t length) {
+    const auto *p = reinterpret_cast<const uint8_t *>(data);
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev = _mm256_setzero_si256();
+    __m256i prevIncomplete = _mm256_setzero_si256();
+    size_t i = 0;
+    alignas(32) uint8_t tail[32];
+
+    while (i < length) {
+        __m256i input;
+        if (length - i >= 32) {
+            input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+        } else {
+            // Zero padding is ASCII, so a truncated sequence shows up as
+            // too short.
+            std::memset(tail, 0, sizeof(tail));
+            std::memcpy(tail, p + i, length - i);
+            input = _mm256_load_si256(reinterpret_cast<const __m256i *>(tail));
+        }
+        if (_mm256_movemask_epi8(input) == 0) {
+            error = _mm256_or_si256(error, prevIncomplete);
+            prevIncomplete = _mm256_setzero_si256();
+        } else {
+            error = _mm256_or_si256(error, checkBlock(input, prev));
+            prevIncomplete = incompleteTail(input);
+        }
+        prev = input;
+        i += 32;
+    }
+    error = _mm256_or_si256(error, prevIncomplete);
+    return _mm256_testz_si256(error, error);
+}
+
+#endif // LEKHIKA_HAVE_X86_SIMD
+
+  //=============================================================================//
+ // Runtime dispatch                                                            //
+//=============================================================================//
+
+struct Backend {
+    const char *name;
+    bool (*validate)(const char *, size_t);
+    unsigned (*classify)(const char *, size_t);
+};
+
+unsigned classifyScalar(const char *data, size_t length) {
+    const auto *p = reinterpret_cast<const uint8_t *>(data);
+    return classifyScalarRange(p, p + length);
+}
+
+Backend selectBackend() {
+#ifdef LEKHIKA_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {"avx2", validateAvx2, classifySse2};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return {"sse2", validateSse2, classifySse2};
+    }
+#endif
+    return {"scalar", validateScalar, classifyScalar};
+}
+
+const Backend &backend() {
+    static const Backend selected = selectBackend();
+    return selected;
+}
+
+} // namespace
+
+bool validateUtf8(const char *data, size_t length) {
+    return backend().validate(data, length);
+}
+
+unsigned classifyScript(const char *data, size_t length) {
+    return backend().classify(data, length);
+}
+
+const char *utf8Backend() { return backend().name; }
+
+} // namespace lekhika
@@ -0,0 +1,55 @@
+#ifndef LEKHIKA_UTF8_H
+#define LEKHIKA_UTF8_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// UTF-8 validation and script classification used on candidate words and
+// on bulk text. Both pick an SSE2 or AVX2 implementation at runtime and
+// fall back to plain scalar code elsewhere.
+namespace lekhika {
+
+enum ScriptFlag : unsigned {
+    ScriptAscii = 1u << 0,      // U+0000..U+007F
+    ScriptDevanagari = 1u << 1, // U+0900..U+097F, plus ZWJ/ZWNJ
+    ScriptOther = 1u << 2,      // anything else
+};
+
+bool validateUtf8(const char *data, size_t length);
+inline bool validateUtf8(const std::string &text) {
+    return validateUtf8(text.data(), text.size());
+}
+
+// Returns the ScriptFlag bits present in already-valid UTF-8 text.
+unsigned classifyScript(const char *data, size_t length);
+inline unsigned classifyScript(const std::string &text) {
+    return classifyScript(text.data(), text.size());
+}
+
+// True for text made only of Devanagari letters, signs and joiners.
+inline bool isDevanagari(const std::string &text) {
+    return !text.empty() && classifyScript(text) == ScriptDevanagari;
+}
+
+// Bytes taken by the first n code points of already-valid UTF-8 text, or
+// the whole text if it is shorter.
+inline size_t codePointPrefix(std::string_view text, size_t n) {
+    size_t i = 0;
+    while (i < text.size() && n > 0) {
+        ++i;
+        while (i < text.size() &&
+               (static_cast<unsigned char>(text[i]) & 0xC0) == 0x80) {
+            ++i;
+        }
+        --n;
+    }
+    return i;
+}
+
+// Name of the implementation picked for this CPU ("avx2", "sse2", "scalar").
+const char *utf8Backend();
+
+} // namespace lekhika
+
+#endif // LEKHIKA_UTF8_H
@@ -0,0 +1,141 @@
+// lekhika-variants.cpp
+
+#include "lekhika-variants.h"
+#include "lekhika-normalize.h"
+#include "lekhika-utf8.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace {
+
+// Code point at pos and its length in bytes; a stray byte stands for
+// itself
+uint32_t codePointAt(const std::string &text, size_t pos, size_t *length) {
+    auto c = static_cast<unsigned char>(text[pos]);
+    size_t n = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+    if (n == 0 || pos + n > text.size()) {
+        *length = 1;
+        return c;
+    }
+    uint32_t cp = n == 1 ? c : c & (0x7F >> n);
+    for (size_t i = 1; i < n; ++i) {
+        cp = (cp << 6) | (static_cast<unsigned char>(text[pos + i]) & 0x3F);
+    }
+    *length = n;
+    return cp;
+}
+
+// Letters, signs and joiners continue a word; dandas do not
+bool continuesWord(uint32_t cp) {
+    return (cp >= 0x0900 && cp <= 0x097F && cp != 0x0964 && cp != 0x0965) ||
+           cp == 0x200C || cp == 0x200D;
+}
+
+} // namespace
+
+void OutputRewrites::clear() {
+    rules_.clear();
+    byFirst_.clear();
+    starts_.reset();
+}
+
+bool OutputRewrites::load(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        auto tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == std::string::npos ||
+            tab == 0) {
+            continue;
+        }
+        Rule rule;
+        rule.from = line.substr(0, tab);
+        rule.wordEnd = rule.from.size() > 1 && rule.from.back() == '$';
+        if (rule.wordEnd) {
+            rule.from.pop_back();
+        }
+        rule.to = lekhika::toNfc(line.substr(tab + 1));
+        if (!lekhika::validateUtf8(rule.from) ||
+            !lekhika::validateUtf8(rule.to)) {
+            continue;
+        }
+        // Matched against normalized text, so kept normalized too
+        rule.from = lekhika::toNfc(std::move(rule.from));
+        std::string key = rule.from + (rule.wordEnd ? "$" : "");
+        rules_[std::move(key)] = std::move(rule);
+    }
+    index();
+    return true;
+}
+
+void OutputRewrites::index() {
+    byFirst_.clear();
+    starts_.reset();
+    for (const auto &[key, rule] : rules_) {
+        size_t length = 0;
+        uint32_t first = codePointAt(rule.from, 0, &length);
+        byFirst_[first].push_back(&rule);
+        if (first < kIndexedCodePoints) {
+            starts_.set(first);
+        }
+    }
+    for (auto &[first, rules] : byFirst_) {
+        // Longest first; an anchored rule before a plain one of the same
+        // length
+        std::sort(rules.begin(), rules.end(), [](const Rule *a, const Rule *b) {
+            return a->from.size() != b->from.size()
+                       ? a->from.size() > b->from.size()
+                       : a->wordEnd > b->wordEnd;
+        });
+    }
+}
+
+std::string OutputRewrites::apply(const std::string &input) const {
+    if (rules_.empty()) {
+        return input;
+    }
+    // Nukta letters may come precomposed from liblekhika
+    std::string normalized;
+    if (!lekhika::isNfcFast(input)) {
+        normalized = lekhika::toNfc(input);
+    }
+    const std::string &text = normalized.empty() ? input : normalized;
+    std::string result;
+    result.reserve(text.size());
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t length = 0;
+        uint32_t cp = codePointAt(text, pos, &length);
+        const Rule *match = nullptr;
+        if (cp >= kIndexedCodePoints || starts_.test(cp)) {
+            auto it = byFirst_.find(cp);
+            if (it != byFirst_.end()) {
+                for (const Rule *rule : it->second) {
+                    size_t end = pos + rule->from.size();
+                    if (text.compare(pos, rule->from.size(), rule->from) != 0) {
+                        continue;
+                    }
+                    size_t nextLength = 0;
+                    if (rule->wordEnd && end < text.size() &&
+                        continuesWord(codePointAt(text, end, &nextLength))) {
+                        continue;
+                    }
+                    match = rule;
+                    break;
+                }
+            }
+        }
+        if (match) {
+            result += match->to;
+            pos += match->from.size();
+        } else {
+            result.append(text, pos, length);
+            pos += length;
+        }
+    }
+    return result;
+}
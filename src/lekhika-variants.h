@@ -0,0 +1,50 @@
+#ifndef LEKHIKA_VARIANTS_H
+#define LEKHIKA_VARIANTS_H
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* ----------  per-language rewrites of the shared transliteration  ---------- */
+// Hindi, Marathi and Sanskrit are typed through the same liblekhika mapping
+// as Nepali; what a language writes differently is rewritten in its output.
+// Rules are matched longest first, at most once per position, and a rule
+// from a later file replaces one from an earlier file.
+//
+// File format, one rule per line:
+//   from<TAB>to
+// Both sides are Devanagari; lines starting with '#' are comments, and an
+// empty right side deletes the text. A left side ending in '$' only
+// matches where a word ends: before a space, a danda, punctuation or the
+// end of the text.
+class OutputRewrites {
+public:
+    bool load(const std::string &path);
+    void clear();
+    bool empty() const { return rules_.empty(); }
+    size_t size() const { return rules_.size(); }
+
+    std::string apply(const std::string &text) const;
+
+private:
+    struct Rule {
+        std::string from;
+        std::string to;
+        bool wordEnd = false;
+    };
+    static constexpr uint32_t kIndexedCodePoints = 0x0980;
+
+    void index();
+
+    // By left side, '$' included, so a later file replaces a rule
+    std::unordered_map<std::string, Rule> rules_;
+    // By the first code point of the left side, longest first
+    std::unordered_map<uint32_t, std::vector<const Rule *>> byFirst_;
+    // Code points below U+0980 that start a rule; the rest go to byFirst_
+    std::bitset<kIndexedCodePoints> starts_;
+};
+
+#endif // LEKHIKA_VARIANTS_H
@@ -0,0 +1,54 @@
+// lekhika-watchdog.cpp
+
+#include "lekhika-watchdog.h"
+
+#include <algorithm>
+#include <limits>
+
+uint64_t LatencyWatchdog::p95() const {
+    if (count_ == 0) {
+        return 0;
+    }
+    std::array<uint32_t, kWindow> sorted = samples_;
+    size_t rank = (count_ * 95 + 99) / 100 - 1;
+    std::nth_element(sorted.begin(), sorted.begin() + rank,
+                     sorted.begin() + count_);
+    return sorted[rank];
+}
+
+LatencyWatchdog::Transition LatencyWatchdog::record(uint64_t latencyUs) {
+    samples_[next_] = static_cast<uint32_t>(
+        std::min<uint64_t>(latencyUs, std::numeric_limits<uint32_t>::max()));
+    next_ = (next_ + 1) % kWindow;
+    count_ = std::min(count_ + 1, kWindow);
+    ++sinceChange_;
+    if (budgetUs_ == 0) {
+        if (degraded_) {
+            degraded_ = false;
+            return Transition::Recovered;
+        }
+        return Transition::None;
+    }
+    if (count_ < kMinSamples) {
+        return Transition::None;
+    }
+
+    uint64_t percentile = p95();
+    if (!degraded_ && percentile > budgetUs_) {
+        degraded_ = true;
+        sinceChange_ = 0;
+        recoverAfter_ = std::min(recoverAfter_ * 2, kMaxRecoverAfter);
+        return Transition::Degraded;
+    }
+    if (degraded_) {
+        // Only a run of keys well under the budget counts towards recovery
+        if (percentile >= budgetUs_ / 2) {
+            sinceChange_ = 0;
+        } else if (sinceChange_ >= recoverAfter_) {
+            degraded_ = false;
+            sinceChange_ = 0;
+            return Transition::Recovered;
+        }
+    }
+    return Transition::None;
+}
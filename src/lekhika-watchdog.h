@@ -0,0 +1,37 @@
+#ifndef LEKHIKA_WATCHDOG_H
+#define LEKHIKA_WATCHDOG_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/* ----------  key latency watchdog  ---------- */
+// Tracks how long the last keys took to handle. When the 95th percentile
+// goes over the budget the owner should drop its expensive work; it may
+// take it up again once the percentile has stayed under half the budget
+// for a while. Every degrade doubles that while, so a machine that keeps
+// flipping between the two settles in the cheap mode.
+class LatencyWatchdog {
+public:
+    enum class Transition { None, Degraded, Recovered };
+
+    void setBudget(uint64_t budgetUs) { budgetUs_ = budgetUs; }
+    Transition record(uint64_t latencyUs);
+    bool degraded() const { return degraded_; }
+    uint64_t p95() const;
+
+private:
+    static constexpr size_t kWindow = 64;
+    static constexpr size_t kMinSamples = 16;
+    static constexpr size_t kMaxRecoverAfter = 1024;
+
+    std::array<uint32_t, kWindow> samples_{};
+    size_t next_ = 0;
+    size_t count_ = 0;
+    uint64_t budgetUs_ = 0; // 0 disables the watchdog
+    bool degraded_ = false;
+    size_t sinceChange_ = 0; // keys since degrading, or calm keys in a row
+    size_t recoverAfter_ = kWindow / 2;
+};
+
+#endif // LEKHIKA_WATCHDOG_H